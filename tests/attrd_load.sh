@@ -0,0 +1,205 @@
+#!/bin/sh
+#
+# Load test of the attribute updates of diskd, against the stand-in of
+# attrd (attrd_standin.c).  INSTANCES daemons of TARGETS targets each check
+# image files, half of whose reads fail, so that the values keep changing.
+# For each delay and failure rate of the stand-in it reports
+#
+#   updates/s   update requests received by the stand-in
+#   ipc_p50     latency of a request in diskd (usec). The median of the p50
+#               of the daemons
+#   ipc_p99     the largest p99 of the daemons, and
+#   ipc_max     the largest of all
+#   reconnect   daemons connected again after the stand-in was down for
+#               OUTAGE sec, and the p50/max of the time it took (msec)
+#   resent      daemons that sent updates again after that
+#
+# It fails if a daemon does not reconnect or resend.  "make check" runs 20
+# daemons of 5 targets; "make bench" (BENCH_FULL=1) runs 200, also against
+# a slow and a failing stand-in.  It has to run as root, as attrd does.
+#
+
+. ${srcdir:-.}/fault_common.sh
+
+: ${STANDIN:=./attrd_standin}
+
+# <delay msec>,<fail percent> of the stand-in
+if [ -n "$BENCH_FULL" ]; then
+	INSTANCES=200
+	TARGETS=5
+	MEASURE=20
+	ATTRDS="0,0 5,0 0,1"
+else
+	INSTANCES=20
+	TARGETS=5
+	MEASURE=5
+	ATTRDS="0,0"
+fi
+OUTAGE=3
+LIMIT=60000	# msec to reconnect. the longest backoff of diskd
+
+STANDIN_PID=""
+LOAD_PIDS=""
+
+load_stop() {
+	if [ -n "$LOAD_PIDS" ]; then
+		kill $LOAD_PIDS 2>/dev/null
+		wait $LOAD_PIDS 2>/dev/null
+		LOAD_PIDS=""
+	fi
+	if [ -n "$STANDIN_PID" ]; then
+		kill $STANDIN_PID 2>/dev/null
+		wait $STANDIN_PID 2>/dev/null
+		STANDIN_PID=""
+	fi
+}
+
+load_cleanup() {
+	load_stop
+	fault_cleanup
+}
+
+# Count the lines of the record after line $1 that match the awk pattern $2.
+record_count() {
+	awk -v from=$1 "NR > from && $2 { n++ } END { print n + 0 }" "$WORK/record"
+}
+
+record_lines() {
+	wc -l <"$WORK/record"
+}
+
+# Wait up to $1 msec until the rest of the arguments print $INSTANCES.
+wait_record() {
+	limit=$1
+	shift
+	start=`now_ms`
+	while true; do
+		n=`"$@"`
+		if [ $n -ge $INSTANCES ]; then
+			return 0
+		fi
+		if [ $((`now_ms` - start)) -ge $limit ]; then
+			return 1
+		fi
+		sleep 0.2
+	done
+}
+
+# The daemons that connected after line $1
+connected_since() {
+	awk -v from=$1 'NR > from && $3 == "connect" { pid[$2] = 1 }
+		END { n = 0; for (p in pid) n++; print n }' "$WORK/record"
+}
+
+# The daemons that sent an update after line $1
+updated_since() {
+	awk -v from=$1 'NR > from && $3 == "update" { pid[$2] = 1 }
+		END { n = 0; for (p in pid) n++; print n }' "$WORK/record"
+}
+
+# "<p50> <max>" msec from line $1, the "up" of the stand-in, to the first
+# connect of each daemon after it
+reconnect_times() {
+	awk -v from=$1 'NR == from { up = $1 }
+		NR > from && $3 == "connect" && !($2 in pid) { pid[$2] = ($1 - up) / 1000 }
+		END { for (p in pid) printf "%d\n", pid[p] }' "$WORK/record" | sort -n |
+	awk '{ t[NR] = $1 } END { if (NR == 0) print "- -"; else print t[int((NR + 1) / 2)], t[NR] }'
+}
+
+# "<median p50> <max p99> <max>" of the ipc latency of the daemons
+ipc_latency() {
+	i=1
+	while [ $i -le $INSTANCES ]; do
+		"$DISKD" -S "$WORK/ctl.$i" -Q stats -t 1 2>/dev/null | sed -n 's/^  ipc  *//p'
+		i=$((i + 1))
+	done | tr ' ' '\n' | awk -F= '$1 == "p50" || $1 == "p99" || $1 == "max" { print $1, $2 }' |
+	sort -k1,1 -k2,2n |
+	awk '{ v[$1, ++n[$1]] = $2 }
+		END {
+			if (n["p50"] == 0) { print "- - -"; exit }
+			print v["p50", int((n["p50"] + 1) / 2)], v["p99", n["p99"]], v["max", n["max"]]
+		}'
+}
+
+# The line of the last "up" of the stand-in
+last_up() {
+	awk '$3 == "up" { n = NR } END { print n + 0 }' "$WORK/record"
+}
+
+load_start() {
+	: >"$WORK/record"
+	"$STANDIN" -o "$WORK/record" -d $1 -f $2 >>"$WORK/log" 2>&1 &
+	STANDIN_PID=$!
+	start=`now_ms`
+	until grep -q " up$" "$WORK/record"; do
+		kill -0 $STANDIN_PID 2>/dev/null || fault_fail "the stand-in of attrd did not start"
+		[ $((`now_ms` - start)) -lt 10000 ] || fault_fail "the stand-in of attrd did not start"
+		sleep 0.1
+	done
+
+	i=1
+	while [ $i -le $INSTANCES ]; do
+		DISKD_FAULT_FILE="$WORK/fault" LD_PRELOAD="$FAULT_LIB" \
+			"$DISKD" -U "$WORK/targets.conf" -S "$WORK/ctl.$i" -p "$WORK/pid.$i" \
+			-E aio -i 500ms -t 1s -r 0 >>"$WORK/log" 2>&1 &
+		LOAD_PIDS="$LOAD_PIDS $!"
+		i=$((i + 1))
+	done
+	wait_record 30000 connected_since 0 || fault_fail "the daemons did not connect"
+}
+
+[ "`id -u`" = 0 ] || fault_skip "the stand-in of attrd has to run as root"
+[ -x "$STANDIN" ] || fault_skip "$STANDIN is not built"
+fault_setup
+trap load_cleanup EXIT
+
+# the targets of a daemon need a path each
+j=1
+while [ $j -le $TARGETS ]; do
+	cp "$WORK/disk.img" "$WORK/disk.$j.img" || fault_fail "could not create the image files"
+	printf "[diskd_load_%d]\nread = %s\n\n" $j "$WORK/disk.$j.img"
+	j=$((j + 1))
+done >"$WORK/targets.conf"
+
+echo "instances=$INSTANCES targets=$(($INSTANCES * $TARGETS)) outage=${OUTAGE}s"
+printf "%-8s %-8s %10s %8s %8s %8s %10s %14s %8s\n" \
+	delay_ms fail_% updates/s ipc_p50 ipc_p99 ipc_max reconnect "p50/max_ms" resent
+for attrd in $ATTRDS; do
+	IFS=, read delay fail <<EOF
+$attrd
+EOF
+	load_start $delay $fail
+	fault eio ops=read prob=50
+
+	from=`record_lines`
+	start=`now_ms`
+	sleep $MEASURE
+	updates=`record_count $from '$3 == "update"'`
+	rate=$(($updates * 1000 / (`now_ms` - start)))
+
+	# the values keep changing, so that the daemons find attrd gone
+	kill -USR1 $STANDIN_PID
+	sleep $OUTAGE
+	down=`last_up`
+	kill -USR2 $STANDIN_PID
+	while [ `last_up` = $down ]; do
+		sleep 0.1
+	done
+	up=`last_up`
+	wait_record $LIMIT connected_since $up
+	reconnected=`connected_since $up`
+	wait_record 10000 updated_since $up
+	resent=`updated_since $up`
+	set -- `reconnect_times $up`
+	times="$1/$2"
+
+	set -- `ipc_latency`
+	printf "%-8s %-8s %10s %8s %8s %8s %10s %14s %8s\n" $delay $fail $rate $1 $2 $3 \
+		"$reconnected/$INSTANCES" "$times" "$resent/$INSTANCES"
+
+	fault_clear
+	load_stop
+	[ $reconnected -eq $INSTANCES ] || fault_fail "$reconnected of $INSTANCES daemons reconnected"
+	[ $resent -eq $INSTANCES ] || fault_fail "$resent of $INSTANCES daemons resent their values"
+done
+exit 0
@@ -0,0 +1,288 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Stand-in of attrd for the load test.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * A libqb IPC server under the name of attrd.  It takes the update
+ * requests of pcmk__node_attr_request, acknowledges them when the client
+ * waits for it, and writes one line per event to the record file:
+ *
+ *   <usec> <pid> connect
+ *   <usec> <pid> update <task> <attr> <value or ->
+ *   <usec> <pid> close
+ *   <usec> 0 down|up
+ *
+ * usec is of the monotonic clock, pid the client.  -d delays each request,
+ * which blocks the whole server as a busy attrd does, and -f drops the
+ * client after that percentage of them.  SIGUSR1 takes the server down
+ * with all its clients, as if attrd stopped, and SIGUSR2 brings it back.
+ *
+ * The clients accept only a server of root or hacluster, so it has to run
+ * as one of them, on a node without attrd.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <qb/qbipcs.h>
+#include <crm/crm.h>
+#include <crm/common/ipc.h>
+#include <crm/common/mainloop.h>
+
+#include "ipc_internal.h"
+
+static GMainLoop *mainloop = NULL;
+static qb_ipcs_service_t *ipcs = NULL;
+static FILE *record = NULL;
+static int delay = 0;		/* msec per request */
+static int fail_percent = 0;	/* of the requests that drop the client */
+static unsigned long long requests = 0;
+
+static struct qb_ipcs_service_handlers standin_handlers;
+
+static void standin_record(int pid, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+
+static void standin_record(int pid, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(record, "%lld %d ", (long long)g_get_monotonic_time(), pid);
+	va_start(ap, fmt);
+	vfprintf(record, fmt, ap);
+	va_end(ap);
+	fputc('\n', record);
+}
+
+static const char *standin_str(const char *value)
+{
+	return value != NULL ? value : "-";
+}
+
+static int standin_pid(qb_ipcs_connection_t *c)
+{
+	return GPOINTER_TO_INT(qb_ipcs_context_get(c));
+}
+
+static int32_t standin_accept(qb_ipcs_connection_t *c, uid_t uid, gid_t gid)
+{
+	return 0;
+}
+
+static void standin_created(qb_ipcs_connection_t *c)
+{
+	struct qb_ipcs_connection_stats stats;
+
+	qb_ipcs_connection_stats_get(c, &stats, 0);
+	qb_ipcs_context_set(c, GINT_TO_POINTER(stats.client_pid));
+	standin_record(stats.client_pid, "connect");
+}
+
+static void standin_ack(qb_ipcs_connection_t *c, const pcmk__ipc_header_t *req)
+{
+	const char *ack = "<ack function=\"attrd_standin\" line=\"0\" status=\"0\"/>";
+	size_t len = strlen(ack) + 1;
+	char buf[sizeof(pcmk__ipc_header_t) + 64];
+	pcmk__ipc_header_t *header = (pcmk__ipc_header_t *)buf;
+
+	memset(header, 0, sizeof(*header));
+	header->qb.id = req->qb.id;
+	header->qb.size = sizeof(*header) + len;
+	header->size_uncompressed = len;
+	header->version = PCMK__IPC_VERSION;
+	memcpy(buf + sizeof(*header), ack, len);
+	if (qb_ipcs_response_send(c, buf, header->qb.size) < 0) {
+		crm_warn("Could not acknowledge the request of %d", standin_pid(c));
+	}
+}
+
+static int32_t standin_msg(qb_ipcs_connection_t *c, void *data, size_t size)
+{
+	const pcmk__ipc_header_t *header = data;
+	const char *text = (const char *)data + sizeof(*header);
+	xmlDoc *doc = NULL;
+	int pid = standin_pid(c);
+
+	requests++;
+	if (delay > 0) {
+		g_usleep(delay * 1000);
+	}
+	if (size <= sizeof(*header) || header->version > PCMK__IPC_VERSION) {
+		standin_record(pid, "invalid");
+	} else if (header->size_compressed != 0) {
+		/* attrd requests are too small for the clients to compress them */
+		standin_record(pid, "compressed");
+	} else if ((doc = xmlReadMemory(text, strnlen(text, size - sizeof(*header)), NULL, NULL,
+			XML_PARSE_NONET | XML_PARSE_NOERROR | XML_PARSE_NOWARNING)) == NULL
+	    || xmlDocGetRootElement(doc) == NULL) {
+		standin_record(pid, "invalid");
+	} else {
+		xmlNode *xml = xmlDocGetRootElement(doc);
+		xmlChar *task = xmlGetProp(xml, (const xmlChar *)"task");
+		xmlChar *name = xmlGetProp(xml, (const xmlChar *)"attr_name");
+		xmlChar *value = xmlGetProp(xml, (const xmlChar *)"attr_value");	/* NULL to delete */
+
+		standin_record(pid, "update %s %s %s", standin_str((const char *)task),
+			standin_str((const char *)name), standin_str((const char *)value));
+		xmlFree(task);
+		xmlFree(name);
+		xmlFree(value);
+	}
+	if (doc != NULL) {
+		xmlFreeDoc(doc);
+	}
+	if (size > sizeof(*header) && (header->flags & crm_ipc_client_response)) {
+		standin_ack(c, header);
+	}
+
+	if (fail_percent > 0 && g_random_int_range(0, 100) < fail_percent) {
+		qb_ipcs_disconnect(c);
+	}
+	return 0;
+}
+
+static int32_t standin_closed(qb_ipcs_connection_t *c)
+{
+	standin_record(standin_pid(c), "close");
+	return 0;
+}
+
+static void standin_destroyed(qb_ipcs_connection_t *c)
+{
+}
+
+static void standin_start(void)
+{
+	ipcs = mainloop_add_ipc_server(T_ATTRD, QB_IPC_NATIVE, &standin_handlers);
+	if (ipcs == NULL) {
+		crm_err("Could not start the IPC server of %s", T_ATTRD);
+		crm_exit(1);
+	}
+	standin_record(0, "up");
+}
+
+static void standin_stop(void)
+{
+	if (ipcs != NULL) {
+		mainloop_del_ipc_server(ipcs);
+		ipcs = NULL;
+		standin_record(0, "down");
+	}
+}
+
+static void standin_signal(int nsig)
+{
+	switch (nsig) {
+		case SIGUSR1:
+			standin_stop();
+			break;
+		case SIGUSR2:
+			if (ipcs == NULL) {
+				standin_start();
+			}
+			break;
+		default:
+			if (g_main_is_running(mainloop)) {
+				g_main_quit(mainloop);
+			}
+			break;
+	}
+}
+
+static void usage(const char *cmd, int exit_status)
+{
+	FILE *stream = exit_status ? stderr : stdout;
+
+	fprintf(stream, "usage: %s [-o file] [-d msec] [-f percent]\n", cmd);
+	fprintf(stream, "    -o <file>\tRecord the events into file. Default=stdout\n");
+	fprintf(stream, "    -d <msec>\tDelay each request\n");
+	fprintf(stream, "    -f <percent>\tDrop the client after the percentage of the requests\n");
+	fflush(stream);
+	exit(exit_status);
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = NULL;
+	int flag;
+
+	crm_log_init("attrd_standin", LOG_INFO, FALSE, TRUE, argc, argv, FALSE);
+
+	while ((flag = getopt(argc, argv, "o:d:f:h")) != EOF) {
+		switch (flag) {
+			case 'o':
+				file = optarg;
+				break;
+			case 'd':
+				delay = atoi(optarg);
+				break;
+			case 'f':
+				fail_percent = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0], 0);
+				break;
+			default:
+				usage(argv[0], 1);
+				break;
+		}
+	}
+	if (optind < argc || delay < 0 || fail_percent < 0 || fail_percent > 100) {
+		usage(argv[0], 1);
+	}
+
+	record = file != NULL ? fopen(file, "a") : stdout;
+	if (record == NULL) {
+		crm_perror(LOG_ERR, "Could not open %s", file);
+		crm_exit(1);
+	}
+	/* the test reads it while it runs */
+	setvbuf(record, NULL, _IOLBF, 0);
+
+	standin_handlers.connection_accept = standin_accept;
+	standin_handlers.connection_created = standin_created;
+	standin_handlers.msg_process = standin_msg;
+	standin_handlers.connection_closed = standin_closed;
+	standin_handlers.connection_destroyed = standin_destroyed;
+
+	mainloop_add_signal(SIGTERM, standin_signal);
+	mainloop_add_signal(SIGINT, standin_signal);
+	mainloop_add_signal(SIGUSR1, standin_signal);
+	mainloop_add_signal(SIGUSR2, standin_signal);
+
+	mainloop = g_main_new(FALSE);
+	standin_start();
+	g_main_run(mainloop);
+
+	standin_stop();
+	crm_info("%llu requests", requests);
+	fclose(record);
+	return 0;
+}
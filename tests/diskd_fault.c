@@ -0,0 +1,603 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Fault injection into the I/O of diskd, loaded with LD_PRELOAD.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * The fault is read from the file named by DISKD_FAULT_FILE whenever the
+ * file changes, so a test changes it while diskd runs.  No file, or an
+ * empty one, means no fault.  The file has one line:
+ *
+ *   <mode> [ops=<op>,...] [path=<prefix>] [delay=<msec>] [prob=<percent>]
+ *
+ *   mode   delay, eio, eagain or hang.  A hang lasts until the file says
+ *          something else.
+ *   ops    open, read, write and fsync.  Default=all of them
+ *   path   the files affected.  Default=all the files opened with O_DIRECT,
+ *          which are the probes of diskd
+ *   delay  msec added to each call by the delay mode.  Default=100
+ *   prob   percent of the calls affected.  Default=100
+ *
+ * The sync engine and the workers are hit in open(), read(), write(),
+ * their p- and v- forms, including pwritev2() of the slots write mode, and
+ * fsync().  The aio engine is hit in io_submit(): eio and eagain fail the
+ * submission, and delay and hang hold the requests back and submit them
+ * later from a thread, so that they complete late as on a slow disk.
+ *
+ * The uring engine is not hit: its requests go through the rings shared
+ * with the kernel, which no library call sees.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/aio_abi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#define FAULT_FD_MAX		4096
+#define FAULT_PATH_MAX		256
+#define FAULT_HELD_MAX		256
+#define FAULT_POLL_MSEC		5
+
+enum fault_mode {
+	fault_none = 0,
+	fault_delay,
+	fault_eio,
+	fault_eagain,
+	fault_hang,
+};
+
+#define FAULT_OP_OPEN		0x01
+#define FAULT_OP_READ		0x02
+#define FAULT_OP_WRITE		0x04
+#define FAULT_OP_FSYNC		0x08
+#define FAULT_OP_ALL		0x0f
+
+typedef struct fault_conf_s {
+	enum fault_mode mode;
+	int ops;
+	char path[FAULT_PATH_MAX];	/* empty for the O_DIRECT files */
+	int delay;			/* msec */
+	int prob;			/* percent */
+} fault_conf_t;
+
+/* a request of the aio engine held back */
+typedef struct fault_held_s {
+	aio_context_t ctx;
+	struct iocb *cb;
+	long long release;		/* monotonic msec. 0 while it hangs */
+} fault_held_t;
+
+static pthread_mutex_t fault_lock = PTHREAD_MUTEX_INITIALIZER;
+static fault_conf_t fault_conf;
+static struct timespec fault_mtime;
+static off_t fault_size = -1;
+static unsigned int fault_seed = 1;
+static char fault_fds[FAULT_FD_MAX];	/* 1 for the files the fault applies to */
+static fault_held_t fault_held[FAULT_HELD_MAX];
+static int fault_nheld = 0;
+static int fault_thread_started = 0;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static ssize_t (*real_pread64)(int, void *, size_t, off64_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+static ssize_t (*real_pwrite64)(int, const void *, size_t, off64_t);
+static ssize_t (*real_preadv)(int, const struct iovec *, int, off_t);
+static ssize_t (*real_pwritev)(int, const struct iovec *, int, off_t);
+static ssize_t (*real_preadv2)(int, const struct iovec *, int, off_t, int);
+static ssize_t (*real_pwritev2)(int, const struct iovec *, int, off_t, int);
+static int (*real_fsync)(int);
+static int (*real_fdatasync)(int);
+static int (*real_close)(int);
+static long (*real_syscall)(long, ...);
+
+static void *fault_next(const char *name)
+{
+	void *fn = dlsym(RTLD_NEXT, name);
+
+	if (fn == NULL) {
+		fprintf(stderr, "diskd_fault: %s not found\n", name);
+		abort();
+	}
+	return fn;
+}
+
+__attribute__((constructor))
+static void fault_init(void)
+{
+	real_open = fault_next("open");
+	real_open64 = fault_next("open64");
+	real_openat = fault_next("openat");
+	real_read = fault_next("read");
+	real_pread = fault_next("pread");
+	real_pread64 = fault_next("pread64");
+	real_write = fault_next("write");
+	real_pwrite = fault_next("pwrite");
+	real_pwrite64 = fault_next("pwrite64");
+	real_preadv = fault_next("preadv");
+	real_pwritev = fault_next("pwritev");
+	real_preadv2 = fault_next("preadv2");
+	real_pwritev2 = fault_next("pwritev2");
+	real_fsync = fault_next("fsync");
+	real_fdatasync = fault_next("fdatasync");
+	real_close = fault_next("close");
+	real_syscall = fault_next("syscall");
+	fault_seed = (unsigned int)getpid();
+}
+
+static long long fault_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void fault_sleep(int msec)
+{
+	struct timespec ts = { msec / 1000, (msec % 1000) * 1000000L };
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+	}
+}
+
+static void fault_parse(const char *line, fault_conf_t *conf)
+{
+	char buf[512], *word, *save = NULL;
+
+	memset(conf, 0, sizeof(*conf));
+	conf->ops = FAULT_OP_ALL;
+	conf->delay = 100;
+	conf->prob = 100;
+
+	snprintf(buf, sizeof(buf), "%s", line);
+	for (word = strtok_r(buf, " \t\n", &save); word != NULL;
+	     word = strtok_r(NULL, " \t\n", &save)) {
+		if (strcmp(word, "delay") == 0) {
+			conf->mode = fault_delay;
+		} else if (strcmp(word, "eio") == 0) {
+			conf->mode = fault_eio;
+		} else if (strcmp(word, "eagain") == 0) {
+			conf->mode = fault_eagain;
+		} else if (strcmp(word, "hang") == 0) {
+			conf->mode = fault_hang;
+		} else if (strncmp(word, "ops=", 4) == 0) {
+			conf->ops = (strstr(word, "open") ? FAULT_OP_OPEN : 0)
+				| (strstr(word, "read") ? FAULT_OP_READ : 0)
+				| (strstr(word, "write") ? FAULT_OP_WRITE : 0)
+				| (strstr(word, "fsync") ? FAULT_OP_FSYNC : 0);
+		} else if (strncmp(word, "path=", 5) == 0) {
+			snprintf(conf->path, sizeof(conf->path), "%s", word + 5);
+		} else if (strncmp(word, "delay=", 6) == 0) {
+			conf->delay = atoi(word + 6);
+		} else if (strncmp(word, "prob=", 5) == 0) {
+			conf->prob = atoi(word + 5);
+		} else {
+			fprintf(stderr, "diskd_fault: unknown word [%s]\n", word);
+		}
+	}
+}
+
+/* The fault in effect. The file is read again when it has changed. */
+static void fault_current(fault_conf_t *conf)
+{
+	const char *file = getenv("DISKD_FAULT_FILE");
+	struct stat st;
+
+	pthread_mutex_lock(&fault_lock);
+	if (file == NULL || stat(file, &st) < 0) {
+		fault_conf.mode = fault_none;
+		fault_size = -1;
+	} else if (st.st_size != fault_size || st.st_mtim.tv_sec != fault_mtime.tv_sec
+		   || st.st_mtim.tv_nsec != fault_mtime.tv_nsec) {
+		char line[512] = "";
+		int fd = real_open(file, O_RDONLY | O_CLOEXEC);
+
+		if (fd >= 0) {
+			ssize_t n = real_read(fd, line, sizeof(line) - 1);
+
+			line[n > 0 ? n : 0] = '\0';
+			real_close(fd);
+		}
+		fault_parse(line, &fault_conf);
+		fault_size = st.st_size;
+		fault_mtime = st.st_mtim;
+	}
+	*conf = fault_conf;
+	pthread_mutex_unlock(&fault_lock);
+}
+
+static int fault_tracked(int fd)
+{
+	return fd >= 0 && fd < FAULT_FD_MAX && fault_fds[fd];
+}
+
+static void fault_track(int fd, const char *path, int flags)
+{
+	fault_conf_t conf;
+
+	if (fd < 0 || fd >= FAULT_FD_MAX) {
+		return;
+	}
+	fault_current(&conf);
+	if (conf.path[0] != '\0') {
+		fault_fds[fd] = (strncmp(path, conf.path, strlen(conf.path)) == 0);
+	} else {
+		fault_fds[fd] = ((flags & O_DIRECT) != 0);
+	}
+}
+
+/* The fault for a call of op, or fault_none. */
+static enum fault_mode fault_pick(int op, fault_conf_t *conf)
+{
+	fault_current(conf);
+	if (conf->mode == fault_none || (conf->ops & op) == 0) {
+		return fault_none;
+	}
+	if (conf->prob < 100 && (int)(rand_r(&fault_seed) % 100) >= conf->prob) {
+		return fault_none;
+	}
+	return conf->mode;
+}
+
+/*
+ * Apply the fault before a call of op.  Returns 0 to go on with the
+ * call, or -1 with errno set to fail it.
+ */
+static int fault_apply(int op)
+{
+	fault_conf_t conf;
+
+	switch (fault_pick(op, &conf)) {
+		case fault_delay:
+			fault_sleep(conf.delay);
+			return 0;
+		case fault_eio:
+			errno = EIO;
+			return -1;
+		case fault_eagain:
+			errno = EAGAIN;
+			return -1;
+		case fault_hang:
+			do {
+				fault_sleep(FAULT_POLL_MSEC);
+				fault_current(&conf);
+			} while (conf.mode == fault_hang && (conf.ops & op));
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+static int fault_open_common(const char *path, int flags)
+{
+	fault_conf_t conf;
+
+	fault_current(&conf);
+	if (conf.mode == fault_none) {
+		return 0;
+	}
+	if (conf.path[0] != '\0' ? strncmp(path, conf.path, strlen(conf.path)) != 0
+	    : (flags & O_DIRECT) == 0) {
+		return 0;
+	}
+	return fault_apply(FAULT_OP_OPEN);
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (fault_open_common(path, flags) < 0) {
+		return -1;
+	}
+	fd = real_open(path, flags, mode);
+	fault_track(fd, path, flags);
+	return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (fault_open_common(path, flags) < 0) {
+		return -1;
+	}
+	fd = real_open64(path, flags, mode);
+	fault_track(fd, path, flags);
+	return fd;
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (fault_open_common(path, flags) < 0) {
+		return -1;
+	}
+	fd = real_openat(dirfd, path, flags, mode);
+	fault_track(fd, path, flags);
+	return fd;
+}
+
+int close(int fd)
+{
+	if (fd >= 0 && fd < FAULT_FD_MAX) {
+		fault_fds[fd] = 0;
+	}
+	return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_READ) < 0) {
+		return -1;
+	}
+	return real_read(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_READ) < 0) {
+		return -1;
+	}
+	return real_pread(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_READ) < 0) {
+		return -1;
+	}
+	return real_pread64(fd, buf, count, offset);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_WRITE) < 0) {
+		return -1;
+	}
+	return real_write(fd, buf, count);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_WRITE) < 0) {
+		return -1;
+	}
+	return real_pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_WRITE) < 0) {
+		return -1;
+	}
+	return real_pwrite64(fd, buf, count, offset);
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_READ) < 0) {
+		return -1;
+	}
+	return real_preadv(fd, iov, iovcnt, offset);
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_WRITE) < 0) {
+		return -1;
+	}
+	return real_pwritev(fd, iov, iovcnt, offset);
+}
+
+ssize_t preadv2(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_READ) < 0) {
+		return -1;
+	}
+	return real_preadv2(fd, iov, iovcnt, offset, flags);
+}
+
+ssize_t pwritev2(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_WRITE) < 0) {
+		return -1;
+	}
+	return real_pwritev2(fd, iov, iovcnt, offset, flags);
+}
+
+int fsync(int fd)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_FSYNC) < 0) {
+		return -1;
+	}
+	return real_fsync(fd);
+}
+
+int fdatasync(int fd)
+{
+	if (fault_tracked(fd) && fault_apply(FAULT_OP_FSYNC) < 0) {
+		return -1;
+	}
+	return real_fdatasync(fd);
+}
+
+/* Submits the held requests that are due, for ever. */
+static void *fault_release_thread(void *data)
+{
+	while (1) {
+		fault_conf_t conf;
+		long long now;
+		int i;
+
+		fault_sleep(FAULT_POLL_MSEC);
+		fault_current(&conf);
+		now = fault_now();
+
+		pthread_mutex_lock(&fault_lock);
+		for (i = 0; i < fault_nheld; ) {
+			fault_held_t *held = &fault_held[i];
+
+			if (held->release == 0 ? conf.mode == fault_hang : now < held->release) {
+				i++;
+				continue;
+			}
+			if (real_syscall(SYS_io_submit, held->ctx, 1L, &held->cb) != 1) {
+				fprintf(stderr, "diskd_fault: a held request could not be submitted\n");
+			}
+			fault_held[i] = fault_held[--fault_nheld];
+		}
+		pthread_mutex_unlock(&fault_lock);
+	}
+	return NULL;
+}
+
+static long fault_io_submit(aio_context_t ctx, long nr, struct iocb **cbs)
+{
+	fault_conf_t conf;
+	enum fault_mode mode;
+	int op;
+	long i;
+
+	if (nr <= 0 || !fault_tracked((int)cbs[0]->aio_fildes)) {
+		return real_syscall(SYS_io_submit, ctx, nr, cbs);
+	}
+	switch (cbs[0]->aio_lio_opcode) {
+		case IOCB_CMD_PREAD:
+			op = FAULT_OP_READ;
+			break;
+		case IOCB_CMD_PWRITE:
+			op = FAULT_OP_WRITE;
+			break;
+		default:
+			op = FAULT_OP_FSYNC;
+			break;
+	}
+	mode = fault_pick(op, &conf);
+	if (mode == fault_eio || mode == fault_eagain) {
+		errno = (mode == fault_eio) ? EIO : EAGAIN;
+		return -1;
+	}
+	if (mode != fault_delay && mode != fault_hang) {
+		return real_syscall(SYS_io_submit, ctx, nr, cbs);
+	}
+
+	pthread_mutex_lock(&fault_lock);
+	if (fault_nheld + nr > FAULT_HELD_MAX) {
+		pthread_mutex_unlock(&fault_lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	for (i = 0; i < nr; i++) {
+		fault_held[fault_nheld].ctx = ctx;
+		fault_held[fault_nheld].cb = cbs[i];
+		fault_held[fault_nheld].release = (mode == fault_hang) ? 0 : fault_now() + conf.delay;
+		fault_nheld++;
+	}
+	if (!fault_thread_started) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, fault_release_thread, NULL) == 0) {
+			pthread_detach(thread);
+			fault_thread_started = 1;
+		}
+	}
+	pthread_mutex_unlock(&fault_lock);
+	return nr;
+}
+
+/* A held request is not known to the kernel yet; it cannot be cancelled. */
+static int fault_held_iocb(struct iocb *cb)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&fault_lock);
+	for (i = 0; i < fault_nheld && !found; i++) {
+		found = (fault_held[i].cb == cb);
+	}
+	pthread_mutex_unlock(&fault_lock);
+	return found;
+}
+
+long syscall(long number, ...)
+{
+	long a[6];
+	va_list ap;
+	int i;
+
+	va_start(ap, number);
+	for (i = 0; i < 6; i++) {
+		a[i] = va_arg(ap, long);
+	}
+	va_end(ap);
+
+	if (number == SYS_io_submit) {
+		return fault_io_submit((aio_context_t)a[0], a[1], (struct iocb **)a[2]);
+	}
+	if (number == SYS_io_cancel && fault_held_iocb((struct iocb *)a[1])) {
+		errno = EINVAL;
+		return -1;
+	}
+	return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
@@ -0,0 +1,148 @@
+#!/bin/sh
+#
+# Benchmark of the detection of diskd under injected faults.  For each
+# engine, set of -i/-t/-r/-I options, realtime mode (-x) or not, and load
+# of the node it reports
+#
+#   cpu_us      CPU time of the daemon per probe of a healthy disk (usec)
+#   fp          ERROR events while the disk is slow, but within the timeout,
+#               among the check cycles of that time
+#   eio_ms      from the first failing read to ERROR
+#   hang_ms     from the start of a hang to ERROR. ">N" if not within N
+#   recover_ms  from the end of the hang to normal
+#
+# The "pressure" load is a process that keeps BENCH_HOG_PCT percent of the
+# available memory in use, and a dd that writes to the file system of the
+# image with O_DIRECT all the time.
+#
+# "make check" runs a short set under pressure; "make bench" (BENCH_FULL=1)
+# runs them all.  A sync probe answers the control socket only when it
+# returns, so the times of the sync engine are coarse.  The realtime mode
+# needs root; without it diskd only warns.
+#
+
+. ${srcdir:-.}/fault_common.sh
+
+# <interval> <timeout> <retry> <retry-interval>
+if [ -n "$BENCH_FULL" ]; then
+	ENGINES="sync sync_e aio worker"
+	CONFIGS="1s,2s,0,500ms 1s,2s,1,500ms 1s,2s,2,500ms 500ms,1s,1,200ms 2s,5s,1,1s"
+	LOADS="idle pressure"
+	HEALTHY=10
+	SLOW=20
+	: ${BENCH_HOG_PCT:=75}
+else
+	ENGINES="sync_e aio"
+	CONFIGS="500ms,1s,1,200ms"
+	LOADS="pressure"
+	HEALTHY=2
+	SLOW=3
+	: ${BENCH_HOG_PCT:=25}
+fi
+REALTIME="no yes"
+
+HOG_PID=""
+DD_PID=""
+
+to_ms() {
+	case "$1" in
+		*ms)	echo ${1%ms};;
+		*s)	echo $((${1%s} * 1000));;
+		*)	echo $(($1 * 1000));;
+	esac
+}
+
+pressure_start() {
+	mb=`awk -v pct=$BENCH_HOG_PCT '/^MemAvailable:/ { print int($2 / 1024 * pct / 100) }' \
+		/proc/meminfo`
+	# dd keeps its one block in memory, and writes it over and over
+	dd if=/dev/zero of=/dev/null bs=${mb:-64}M 2>/dev/null &
+	HOG_PID=$!
+	while true; do
+		dd if=/dev/zero of="$WORK/pressure.img" bs=1M count=256 oflag=direct \
+			conv=notrunc 2>/dev/null
+	done &
+	DD_PID=$!
+}
+
+pressure_stop() {
+	if [ -n "$DD_PID" ]; then
+		# the loop, then the dd it runs
+		children=`pgrep -P $DD_PID`
+		kill $DD_PID $children 2>/dev/null
+		wait $DD_PID 2>/dev/null
+		DD_PID=""
+	fi
+	if [ -n "$HOG_PID" ]; then
+		kill $HOG_PID 2>/dev/null
+		wait $HOG_PID 2>/dev/null
+		HOG_PID=""
+	fi
+	rm -f "$WORK/pressure.img"
+}
+
+bench_cleanup() {
+	pressure_stop
+	fault_cleanup
+}
+
+fault_setup
+trap bench_cleanup EXIT
+
+printf "%-8s %-26s %-3s %-8s %8s %10s %8s %10s %10s\n" \
+	engine options rt load cpu_us fp eio_ms hang_ms recover_ms
+for load in $LOADS; do
+	if [ "$load" = "pressure" ]; then
+		pressure_start
+	fi
+	for engine in $ENGINES; do
+		for config in $CONFIGS; do
+			for rt in $REALTIME; do
+				IFS=, read interval timeout retry rinterval <<EOF
+$config
+EOF
+				options="-i $interval -t $timeout -r $retry -I $rinterval"
+				t=`to_ms $timeout`
+				# the longest a cycle can take to fail, twice
+				limit=$((2 * (`to_ms $interval` + ($retry + 1) * $t + $retry * `to_ms $rinterval`) + 2000))
+
+				rt_option=""
+				if [ "$rt" = "yes" ]; then
+					rt_option="-x"
+				fi
+				if [ "$engine" = "sync_e" ]; then
+					diskd_start -E sync -e $options $rt_option
+				else
+					diskd_start -E $engine $options $rt_option
+				fi
+
+				sleep $HEALTHY
+				cpu=`diskd_cpu_per_probe`
+
+				events=`diskd_stat error_events`
+				probes=`diskd_stat probes`
+				fault delay ops=read delay=$(($t / 2)) prob=30
+				sleep $SLOW
+				fault_clear
+				wait_value normal $limit >/dev/null
+				fp="$((`diskd_stat error_events` - $events))/$((`diskd_stat probes` - $probes))"
+
+				fault eio ops=read
+				eio=`wait_value ERROR $limit` || eio=">$limit"
+				fault_clear
+				wait_value normal $limit >/dev/null
+
+				fault hang ops=read
+				hang=`wait_logged_error $limit` || hang=">$limit"
+				fault_clear
+				recover=`wait_value normal $limit` || recover=">$limit"
+
+				printf "%-8s %-26s %-3s %-8s %8s %10s %8s %10s %10s\n" $engine "$options" \
+					$rt $load "$cpu" "$fp" "$eio" "$hang" "$recover"
+				diskd_stop
+			done
+		done
+	done
+	pressure_stop
+done
+exit 0
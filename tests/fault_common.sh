@@ -0,0 +1,153 @@
+#
+# Helpers of the fault tests of diskd, sourced by each of them.
+#
+# diskd runs in the foreground on an image file, with the I/O of its
+# probes going through the fault injection library (diskd_fault.c).
+# The results are read from its control socket, or from its log while
+# a sync probe blocks the socket.
+#
+# DISKD		the diskd to test
+# FAULT_LIB	the fault injection library
+#
+
+: ${DISKD:=../tools/diskd}
+: ${FAULT_LIB:=.libs/libdiskd_fault.so}
+
+SKIP=77
+DISKD_PID=""
+
+fault_skip() {
+	echo "SKIP: $*"
+	exit $SKIP
+}
+
+fault_fail() {
+	echo "FAIL: $*"
+	if [ -f "$WORK/log" ]; then
+		echo "--- diskd log"
+		tail -n 30 "$WORK/log"
+	fi
+	exit 1
+}
+
+fault_cleanup() {
+	fault_clear
+	diskd_stop
+	rm -rf "$WORK"
+}
+
+fault_setup() {
+	[ -x "$DISKD" ] || fault_skip "$DISKD is not built"
+	[ -f "$FAULT_LIB" ] || fault_skip "$FAULT_LIB is not built"
+	# the attributes would go to a live cluster
+	if pgrep -x pacemaker-attrd >/dev/null 2>&1 || pgrep -x attrd >/dev/null 2>&1; then
+		fault_skip "attrd is running on this node"
+	fi
+
+	WORK=`mktemp -d ${TMPDIR:-/tmp}/diskd-test.XXXXXX` || fault_fail "mktemp failed"
+	trap fault_cleanup EXIT
+	dd if=/dev/zero of="$WORK/disk.img" bs=1M count=16 2>/dev/null \
+		|| fault_fail "could not create the image file"
+	# the probes use O_DIRECT, which tmpfs does not support everywhere
+	dd if="$WORK/disk.img" of=/dev/null bs=4096 count=1 iflag=direct 2>/dev/null \
+		|| fault_skip "O_DIRECT is not supported in $WORK"
+}
+
+now_ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+# Start diskd with the target and the options given.
+diskd_run() {
+	fault_clear
+	PCMK_logfile="$WORK/log" DISKD_FAULT_FILE="$WORK/fault" LD_PRELOAD="$FAULT_LIB" \
+		"$DISKD" -a diskd_test -S "$WORK/ctl.sock" -p "$WORK/pid" \
+		"$@" >>"$WORK/log" 2>&1 &
+	DISKD_PID=$!
+	wait_value normal 10000 >/dev/null || fault_fail "diskd $* did not start"
+}
+
+# Start diskd on the image with the options given.
+diskd_start() {
+	diskd_run -N "$WORK/disk.img" "$@"
+}
+
+# Start diskd writing to $WORK/wdir with the options given.  Its file may
+# not be opened with O_DIRECT, so the faults take path=$WORK/wdir/.
+diskd_start_write() {
+	mkdir -p "$WORK/wdir" || fault_fail "could not create $WORK/wdir"
+	diskd_run -w -d "$WORK/wdir" "$@"
+}
+
+diskd_stop() {
+	if [ -n "$DISKD_PID" ]; then
+		kill $DISKD_PID 2>/dev/null
+		wait $DISKD_PID 2>/dev/null
+		DISKD_PID=""
+	fi
+}
+
+diskd_query() {
+	"$DISKD" -S "$WORK/ctl.sock" -Q "$1" -t 1 2>/dev/null
+}
+
+# The value of the target, "none" before the first result, or empty.
+diskd_value() {
+	diskd_query status | sed -n 's/^target [^ ]* value=\([^ ]*\) .*/\1/p'
+}
+
+# A counter of the target in the stats, e.g. probes or error_events.
+diskd_stat() {
+	diskd_query stats | sed -n "s/^target .* $1=\([^ ]*\).*/\1/p"
+}
+
+diskd_cpu_per_probe() {
+	diskd_query stats | sed -n 's/^process .* cpu_per_probe=\([0-9]*\).*/\1/p'
+}
+
+# Inject the fault of diskd_fault.c, e.g. "hang ops=read".
+fault() {
+	echo "$*" >"$WORK/fault.new" && mv -f "$WORK/fault.new" "$WORK/fault"
+}
+
+fault_clear() {
+	rm -f "$WORK/fault"
+}
+
+# Wait up to limit msec for the value. Prints the msec it took.
+wait_value() {
+	value=$1
+	limit=$2
+	start=`now_ms`
+	while true; do
+		current=`diskd_value`
+		elapsed=$((`now_ms` - start))
+		if [ "$current" = "$value" ]; then
+			echo $elapsed
+			return 0
+		fi
+		if [ $elapsed -ge $limit ]; then
+			return 1
+		fi
+		sleep 0.05
+	done
+}
+
+# Wait up to limit msec for diskd to report ERROR in its log. Prints the
+# msec it took.
+wait_logged_error() {
+	limit=$1
+	from=`wc -l <"$WORK/log"`
+	start=`now_ms`
+	while true; do
+		elapsed=$((`now_ms` - start))
+		if tail -n +$((from + 1)) "$WORK/log" | grep -q "new_status=ERROR"; then
+			echo $elapsed
+			return 0
+		fi
+		if [ $elapsed -ge $limit ]; then
+			return 1
+		fi
+		sleep 0.05
+	done
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Each engine sets ERROR for a failing and a hung disk, returns to normal
+# after it, and does not set ERROR for a disk that is only slow.  Then each
+# write mode sets ERROR when its writes fail.
+#
+# The uring engine is not tested: the library of the faults does not see
+# its requests (see diskd_fault.c).
+#
+
+. ${srcdir:-.}/fault_common.sh
+
+fault_setup
+
+for engine in "sync -e" aio worker; do
+	echo "== engine $engine"
+	diskd_start -E $engine -i 200ms -t 500ms -r 1 -I 100ms
+
+	fault eio ops=read
+	wait_value ERROR 3000 >/dev/null || fault_fail "$engine: no ERROR on EIO"
+	fault_clear
+	wait_value normal 3000 >/dev/null || fault_fail "$engine: no recovery after EIO"
+
+	fault eio ops=open
+	wait_value ERROR 3000 >/dev/null || fault_fail "$engine: no ERROR when open fails"
+	fault_clear
+	wait_value normal 3000 >/dev/null || fault_fail "$engine: no recovery after open"
+
+	# a sync probe is reported by the timer thread while it hangs
+	fault hang ops=read
+	wait_logged_error 3000 >/dev/null || fault_fail "$engine: no ERROR on a hang"
+	fault_clear
+	wait_value normal 5000 >/dev/null || fault_fail "$engine: no recovery after a hang"
+
+	# slow, but within the timeout
+	events=`diskd_stat error_events`
+	fault delay ops=read delay=100
+	sleep 2
+	fault_clear
+	[ "`diskd_stat error_events`" = "$events" ] || fault_fail "$engine: ERROR on a slow disk"
+	[ "`diskd_stat timeouts`" != "" ] || fault_fail "$engine: no stats"
+
+	diskd_stop
+done
+echo "== engine uring: SKIP, its I/O does not go through the library of the faults"
+
+# the classic mode, and the slots mode in each of its durabilities, the
+# last one by pwritev2()
+for engine in "sync -e" aio; do
+	for mode in "" "-W slots -Y dsync" "-W slots -Y fdatasync" "-W slots -Y rwf-dsync"; do
+		echo "== write engine $engine $mode"
+		diskd_start_write -E $engine $mode -i 200ms -t 500ms -r 1 -I 100ms
+
+		fault eio ops=write path="$WORK/wdir/"
+		wait_value ERROR 3000 >/dev/null || fault_fail "$engine $mode: no ERROR on EIO"
+		fault_clear
+		wait_value normal 3000 >/dev/null || fault_fail "$engine $mode: no recovery after EIO"
+
+		diskd_stop
+	done
+done
+echo "PASS"
+exit 0
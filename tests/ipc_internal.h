@@ -0,0 +1,38 @@
+/*
+ * Copyright 2013-2021 the Pacemaker project contributors
+ *
+ * The version control history for this file may have further details.
+ *
+ * This source code is licensed under the GNU Lesser General Public License
+ * version 2.1 or later (LGPLv2.1+) WITHOUT ANY WARRANTY.
+ */
+
+#ifndef PCMK__IPC_INTERNAL_H
+#  define PCMK__IPC_INTERNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#  include <stdint.h>
+#  include <qb/qbipc_common.h>
+
+/* The part of crm/common/ipc_internal.h that the stand-in of attrd needs.
+ * Pacemaker does not install that header.
+ */
+
+#define PCMK__IPC_VERSION 1
+
+typedef struct pcmk__ipc_header_s {
+    struct qb_ipc_response_header qb;
+    uint32_t size_uncompressed;
+    uint32_t size_compressed;
+    uint32_t flags;
+    uint8_t version;
+} pcmk__ipc_header_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
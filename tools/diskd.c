@@ -32,7 +32,11 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
 
 #include <stdlib.h>
 #include <errno.h>
@@ -43,22 +47,19 @@
 
 #include <attrd_internal.h>
 #include <crm/common/mainloop.h>
+#include <diskd.h>
 #ifdef HAVE_GETOPT_H
 #  include <getopt.h>
 #endif
 
-#define MIN_INTERVAL		1
-#define MAX_INTERVAL		3600
-#define MIN_TIMEOUT		1
-#define MAX_TIMEOUT		600
+#define MIN_INTERVAL		100	/* msec */
+#define MAX_INTERVAL		3600000
+#define MIN_TIMEOUT		100
+#define MAX_TIMEOUT		600000
 #define MIN_RETRY		0
 #define MAX_RETRY		10
-#define MIN_RETRY_INTERVAL	1
-#define MAX_RETRY_INTERVAL	3600
-/* status */
-#define ERROR			1
-#define normal			-1
-#define NONE			2
+#define MIN_RETRY_INTERVAL	10
+#define MAX_RETRY_INTERVAL	3600000
 
 #define WRITE_DATA		64
 
@@ -66,7 +67,51 @@
 #define WRITE_FILE		"diskcheck"
 #define PID_FILE		"/tmp/diskd.pid"
 
-#define OPTARGS			"N:wd:a:i:p:DV?t:r:I:oem:"
+#define ATTRD_BACKOFF_MIN	1	/* attrd reconnect interval. sec. */
+#define ATTRD_BACKOFF_MAX	60
+#define MIN_REFRESH		0
+#define MAX_REFRESH		86400
+#define MIN_COALESCE		0
+#define MAX_COALESCE		10000
+#define MIN_DEGRADED_MS		0
+#define MAX_DEGRADED_MS		600000
+#define MIN_DEGRADED_COUNT	1
+#define MAX_DEGRADED_COUNT	100
+#define MAX_DEGRADED_FACTOR	1000.0
+#define MIN_SAMPLES		1
+#define MAX_SAMPLES		64
+#define MAX_SYNC_SAMPLES	4	/* the sync engine reads them one after another */
+#define MIN_BLOCK_SIZE		512
+#define MAX_BLOCK_SIZE		(1024 * 1024)
+#define MAX_SAMPLE_BYTES	(16 * 1024 * 1024)	/* samples * block size */
+#define MIN_SLOTS		1
+#define MAX_SLOTS		1024
+#define MIN_STUCK		1
+#define MAX_STUCK		64
+#define MIN_DEADLINE		1
+#define MAX_DEADLINE		3600
+#define MIN_RT_PRIORITY		1
+#define MAX_RT_PRIORITY		99
+#define MIN_BURST_INTERVAL	60000	/* msec */
+#define MAX_BURST_INTERVAL	86400000
+#define MIN_BURST_DEPTH		1
+#define MAX_BURST_DEPTH		64
+#define MIN_BURST_DURATION	100	/* msec */
+#define MAX_BURST_DURATION	10000
+#define MIN_BURST_MB		1
+#define MAX_BURST_MB		1024
+#define BURST_DUTY		10	/* the interval is this many times the duration or more */
+#define MIN_TRACE_RECORDS	64
+#define MAX_TRACE_RECORDS	(1024 * 1024)
+
+#define SPIKE_FACTOR		4	/* latency/baseline that shortens the interval */
+#define PASSIVE_MAX_SKIPS	10	/* a passive target is probed at least this often */
+
+#define BASELINE_SHIFT		3	/* EWMA weight of a new sample, 1/8 */
+#define BASELINE_MIN_SAMPLES	8	/* samples before the relative threshold applies */
+#define DEGRADED_MIN_LATENCY	1000	/* usec. the relative threshold never goes below */
+
+#define OPTARGS			"N:wd:a:i:p:DV?t:r:I:oem:T:E:R:C:S:Q:L:F:K:n:b:M:s:W:Y:Z:Xj:J:O:PAu:f:g:xy:B:c:G:U:"
 
 GMainLoop* mainloop = NULL;
 const char *diskd_attr = "diskd";
@@ -81,15 +126,46 @@ gboolean wflag = FALSE;
 int optflag = 0;		/* flag for duplicate */
 
 int retry = 1;			/* disk check retry. default 1 times */
-int retry_interval = 5;		/* disk check retry intarval time. default 5sec. */
-int interval = 30;		/* disk check interval. default 30sec.*/
-int timeout = 60;		/* disk check read func timeout. default 60sec. */
+int retry_interval = 5000;	/* disk check retry intarval time. default 5sec. msec */
+int interval = 30000;		/* disk check interval. default 30sec. msec */
+int min_interval = 0;		/* shortest adaptive interval. 0=interval */
+int max_interval = 0;		/* longest adaptive interval. 0=interval */
+int timeout = 60000;		/* disk check read func timeout. default 60sec. msec */
+int degraded_ms = 0;		/* latency to report degraded. msec. 0=off */
+double degraded_factor = 0;	/* latency/baseline to report degraded. 0=off */
+int degraded_count = 3;		/* consecutive slow or fast checks to change */
+int fail_n = 1;			/* -f <n>/<m>: failed cycles in a window to set ERROR */
+int fail_m = 1;
+int recover_n = 1;		/* -g <n>/<m>: good cycles in a window to clear it */
+int recover_m = 1;
+int samples = 1;		/* blocks read by a read check */
+int block_size = 0;		/* bytes. 0=pagesize */
+int sample_mode = diskd_sample_head;
+guint64 sample_seed = 0;
+int write_mode = diskd_write_create;
+int durability = diskd_durability_dsync;
+int slots = 16;			/* pages in the probe file of the slots mode */
+int verify_flag = 0;
+int paths_flag = 0;		/* check the slaves of a multipath device too */
+int passive_flag = 0;		/* skip the probe of a device busy with others' I/O */
+diskd_burst_conf_t burst_conf = {	/* -G */
+	0, 4, 65536, 100, 1000, 64
+};
 int oneshot_flag = 0;
+int oneshot_deadline = 0;	/* -o gives up after this. sec. 0=worst case of the checks */
 int exec_thread_flag = 0;
-const char *diskcheck_value = NULL;
 int pagesize = 0;
-void *ptr = NULL;
-void *buf;
+
+GList *targets = NULL;			/* list of diskd_target_t */
+static crm_ipc_t *attrd_ipc = NULL;	/* connection to attrd */
+static guint attrd_reconnect_id = 0;
+static int attrd_backoff = 0;
+static guint attrd_flush_id = 0;
+static int attr_refresh = 300;		/* resend an unchanged value. sec. 0=never */
+static int attr_coalesce = 0;		/* window to batch changed values. msec. */
+static GList *target_specs = NULL;	/* -T option arguments */
+static char *config_file = NULL;	/* -U. read again by a reload */
+diskd_attrd_stats_t attrd_stats;
 
 //#if PACEMAKER_GE_1113
 int attr_options = pcmk__node_attr_none;
@@ -99,39 +175,54 @@ int attr_options = pcmk__node_attr_none;
 
 #if GLIB_CHECK_VERSION(2, 32, 0)
 GMutex diskd_mutex;
-GCond diskd_cond;
-GMutex thread_start_mutex;
-GCond thread_start_cond;
+GMutex watchdog_mutex;
+GCond watchdog_cond;
 #else
 static GMutex *diskd_mutex = NULL;		/* Thread Mutex */
-static GCond *diskd_cond = NULL;		/* Thread Cond */
-static GMutex *thread_start_mutex = NULL;	/* Thread Start Mutex */
-static GCond *thread_start_cond = NULL;		/* Thread Start Cond */
+static GMutex *watchdog_mutex = NULL;		/* guards the watchdog_* variables */
+static GCond *watchdog_cond = NULL;
 #endif
 static gboolean diskd_thread_use = FALSE;	/* Tthred Timer Flag */
 static GThread *th_timer = NULL;		/* Thread Timer */
-static int timer_id = -1;
+
+/* The timer thread watches one check at a time, the one that is armed. */
+static diskd_target_t *watchdog_target = NULL;	/* NULL when disarmed */
+static gboolean watchdog_fired = FALSE;		/* the armed check missed its deadline */
+static gboolean watchdog_publishing = FALSE;	/* the thread is reporting it */
+static gint64 watchdog_deadline = 0;		/* monotonic. usec */
+static guint64 watchdog_gen = 0;		/* bumped by every arm and disarm */
+static gboolean watchdog_quit = FALSE;
 
 static void diskd_thread_timer_init(void);
-static void diskd_thread_create(void);
+static void diskd_thread_arm(diskd_target_t *target);
 static void diskd_thread_timer_variable_free(void);
-static void diskd_thread_condsend(void);
+static gboolean diskd_thread_disarm(void);
+static void diskd_thread_release(diskd_target_t *target);
 static void diskd_thread_timer_end(void);
-void send_update(void);
+void send_update(diskd_target_t *target);
+static gboolean diskd_attrd_connect(void);
+static void diskd_attrd_disconnect(void);
+static void diskd_attrd_schedule_reconnect(void);
+static void diskd_attrd_queue(diskd_target_t *target);
+static gboolean diskd_attrd_need_update(diskd_target_t *target);
+static void diskd_attrd_delete(const char *attr);
 //void crm_make_daemon(const char *name, gboolean daemonize, const char *pidfile);
 void pcmk__daemonize(const char *name, const char *pidfile);
 
 static void
 diskd_shutdown(int nsig)
 {
+	GList *gIter;
+
 	crm_info("Exiting");
 
-	if (timer_id != -1) {
-		g_source_remove(timer_id);
-		timer_id = -1;
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		diskd_sched_remove(target);
 	}
 
-	diskd_thread_condsend();
+	diskd_thread_disarm();
 
 	if (mainloop != NULL && g_main_is_running(mainloop)) {
 		g_main_quit(mainloop);
@@ -146,7 +237,7 @@ usage(const char *cmd, int crm_exit_status)
 	FILE *stream;
 	stream = crm_exit_status ? stderr : stdout;
 
-	fprintf(stream, "usage: %s (-N|-w) [-daipDV?trIoem]\n", cmd);
+	fprintf(stream, "usage: %s (-N|-w|-T|-U) [-daipDV?trIoemE]\n", cmd);
 	fprintf(stream, "\nBasic options\n");
 	fprintf(stream, "    --%s (-%c) <device>\tDevice name to read\n"
 		"\t\t\t\t\t * Required option\n", "read-device-name", 'N');
@@ -156,26 +247,138 @@ usage(const char *cmd, int crm_exit_status)
 		"\t\t\t\t\tDirectory Name to write\n", "write-directory-name", 'd');
 	fprintf(stream, "    --%s (-%c) <string>\t\tName of the node attribute to set\n"
 		"\t\t\t\t\t * Default=diskd\n", "attr-name", 'a');
-	fprintf(stream, "    --%s (-%c) <time[s]>\t\tDisk status check interval time\n"
+	fprintf(stream, "    --%s (-%c) <time>\t\tDisk status check interval time\n"
 		"\t\t\t\t\t * Default=30 sec.\n", "interval", 'i');
+	fprintf(stream, "    --%s (-%c) <time>\tShortest interval, used after trouble\n"
+		"\t\t\t\t\t * Default=interval\n", "min-interval", 'j');
+	fprintf(stream, "    --%s (-%c) <time>\tLongest interval, reached while healthy\n"
+		"\t\t\t\t\t * Default=interval\n", "max-interval", 'J');
 	fprintf(stream, "    --%s (-%c) <file>\t\tFile in which to store the process' PID\n"
 		"\t\t\t\t\t * Default=%s\n", "pid-file", 'p', PID_FILE);
 	fprintf(stream, "    --%s (-%c)\t\t\tRun in daemon mode\n", "daemonize", 'D');
 	fprintf(stream, "    --%s (-%c)\t\t\tRun in verbose mode\n", "verbose", 'V');
-	fprintf(stream, "    --%s (-%c)\t\t\tDisk check one time\n", "oneshot", 'o');
+	fprintf(stream, "    --%s (-%c)\t\t\tDisk check one time\n"
+		"\t\t\t\t\t * All targets are checked in parallel, and the\n"
+		"\t\t\t\t\t   result of each is printed\n", "oneshot", 'o');
+	fprintf(stream, "    --%s (-%c) <time[s]>\t\tReport the targets not checked within this time as ERROR\n"
+		"\t\t\t\t\t * Default=the longest check with all retries\n"
+		"\t\t\t\t\t * Valid only with the oneshot parameter\n", "deadline", 'O');
 	fprintf(stream, "    --%s (-%c)\t\t\tCheck of the disk status check timeout by the thread\n"
 		"\t\t\t\t\t * Default=60 sec.(Same value as check-timeout parameter)\n"
 		"\t\t\t\t\t * Invalid at the time of the oneshot parameter designation\n", "exec-thread", 'e');
 	fprintf(stream, "    --%s (-%c) <time[s]>\t\tDampening interval\n"
 		"\t\t\t\t\t * Default=0 sec.\n", "dampen", 'm');
+	fprintf(stream, "    --%s (-%c) <time[s]>\t\tResend an unchanged attribute value after this time\n"
+		"\t\t\t\t\t * Default=300 sec. 0 sends changes only\n", "refresh", 'R');
+	fprintf(stream, "    --%s (-%c) <time[ms]>\tSend the changes within this time together\n"
+		"\t\t\t\t\t * Default=0 msec.\n", "coalesce", 'C');
 	fprintf(stream, "    --%s (-%c)\t\t\t\tThis text\n", "help", '?');
-	fprintf(stream, "\nNote: -N, -w options cannot be specified at the same time.\n\n");
+	fprintf(stream, "    --%s (-%c) <type>:<path>[,<key>=<value>...]\n"
+		"\t\t\t\t\tAdd a target to monitor. May be repeated\n"
+		"\t\t\t\t\t * type is \"read\" (device) or \"write\" (directory)\n"
+		"\t\t\t\t\t * keys: attr, interval, min-interval, max-interval,\n"
+		"\t\t\t\t\t   timeout, retry, retry-interval, phase, passive,\n"
+		"\t\t\t\t\t   degraded-latency, degraded-factor, degraded-count,\n"
+		"\t\t\t\t\t   fail-window, recover-window,\n"
+		"\t\t\t\t\t   samples, block-size, sample, seed, paths (read targets),\n"
+		"\t\t\t\t\t   write-mode, durability, slots, verify (write targets)\n"
+		"\t\t\t\t\t   and the keys of -G with a burst- prefix\n"
+		"\t\t\t\t\t * Default attr=<attr-name>_<basename of path>\n"
+		"\t\t\t\t\t * Default phase spreads the first checks of the\n"
+		"\t\t\t\t\t   targets over their interval\n", "target", 'T');
+	fprintf(stream, "    --%s (-%c) <file>\t\tRead more targets from a file. Each [<attr>] group is a\n"
+		"\t\t\t\t\ttarget with a read=<device> or write=<directory> key\n"
+		"\t\t\t\t\tand the other keys of -T. A [defaults] group has the\n"
+		"\t\t\t\t\tkeys of all targets\n"
+		"\t\t\t\t\t * SIGHUP or the reload command of -Q reads it again.\n"
+		"\t\t\t\t\t   Only the changed targets are restarted, and they\n"
+		"\t\t\t\t\t   keep their attribute value and statistics\n", "config", 'U');
+	fprintf(stream, "    --%s (-%c) <engine>\t\tI/O engine of the check. sync, aio, uring, worker or auto\n"
+		"\t\t\t\t\t * Default=sync\n"
+		"\t\t\t\t\t * aio and uring never block the daemon on the disk\n"
+		"\t\t\t\t\t * worker checks each target in a process of its own,\n"
+		"\t\t\t\t\t   replaced when a check misses its timeout\n"
+		"\t\t\t\t\t * Invalid at the time of the oneshot parameter designation\n", "io-engine", 'E');
+	fprintf(stream, "    --%s (-%c) <number>\t\tWorkers stuck in I/O after which no more are started\n"
+		"\t\t\t\t\t * Default=4\n", "max-stuck", 'u');
+	fprintf(stream, "    --%s (-%c)\t\t\tLock the memory and check with the realtime I/O class\n"
+		"\t\t\t\t\t * Invalid at the time of the oneshot parameter designation\n",
+		"realtime", 'x');
+	fprintf(stream, "    --%s (-%c) <priority>\tRun under SCHED_FIFO in the realtime mode. 1-99\n"
+		"\t\t\t\t\t * Default=0 (not used)\n", "rt-priority", 'y');
+	fprintf(stream, "    --%s (-%c) <time[ms]>\tSet \"degraded\" when a check takes longer\n"
+		"\t\t\t\t\t * Default=0 (not used)\n", "degraded-latency", 'L');
+	fprintf(stream, "    --%s (-%c) <factor>\tSet \"degraded\" when a check takes longer than\n"
+		"\t\t\t\t\tfactor times the average of the target\n"
+		"\t\t\t\t\t * Default=0 (not used)\n", "degraded-factor", 'F');
+	fprintf(stream, "    --%s (-%c) <times>\tConsecutive slow (fast) checks to set (clear) \"degraded\"\n"
+		"\t\t\t\t\t * Default=3 times\n", "degraded-count", 'K');
+	fprintf(stream, "    --%s (-%c) <n>/<m>\tSet \"ERROR\" when n of the last m check cycles failed\n"
+		"\t\t\t\t\t * Default=1/1. m is up to %d\n", "fail-window", 'f', DISKD_VOTE_MAX);
+	fprintf(stream, "    --%s (-%c) <n>/<m>\tClear \"ERROR\" when n of the last m check cycles succeeded\n"
+		"\t\t\t\t\t * Default=1/1\n", "recover-window", 'g');
+	fprintf(stream, "    --%s (-%c) <number>\t\tBlocks read by each read check\n"
+		"\t\t\t\t\t * Default=1\n"
+		"\t\t\t\t\t * The sync engine reads them one after another, and\n"
+		"\t\t\t\t\t   up to %d of them. aio and uring read all at once\n",
+		"samples", 'n', MAX_SYNC_SAMPLES);
+	fprintf(stream, "    --%s (-%c) <bytes>\t\tSize of the blocks read, a multiple of 512\n"
+		"\t\t\t\t\t * Default=page size\n", "block-size", 'b');
+	fprintf(stream, "    --%s (-%c) <mode>\t\tWhich blocks are read. head, random or stride\n"
+		"\t\t\t\t\t * Default=head (the first blocks of the device)\n"
+		"\t\t\t\t\t * random and stride cover the whole device\n", "sample-mode", 'M');
+	fprintf(stream, "    --%s (-%c) <number>\t\tSeed of the random and stride offsets\n"
+		"\t\t\t\t\t * Default=0\n", "seed", 's');
+	fprintf(stream, "    --%s (-%c) <mode>\t\tHow the write check writes. create or slots\n"
+		"\t\t\t\t\t * Default=create (create and remove the file each time)\n"
+		"\t\t\t\t\t * slots rewrites pages of a file allocated once\n", "write-mode", 'W');
+	fprintf(stream, "    --%s (-%c) <sync>\t\tHow a write of the slots mode is made durable\n"
+		"\t\t\t\t\tdsync, fdatasync or rwf-dsync\n"
+		"\t\t\t\t\t * Default=dsync\n", "durability", 'Y');
+	fprintf(stream, "    --%s (-%c) <number>\t\tPages in the file of the slots mode\n"
+		"\t\t\t\t\t * Default=16\n", "slots", 'Z');
+	fprintf(stream, "    --%s (-%c)\t\t\tRead each write of the slots mode back and check it\n", "verify", 'X');
+	fprintf(stream, "    --%s (-%c)\t\t\tAlso check each path of a multipath device\n"
+		"\t\t\t\t\t * The number of working paths is set to <attr-name>_paths_ok\n", "paths", 'P');
+	fprintf(stream, "    --%s (-%c)\t\t\tSkip the check while the kernel reports completed I/O\n"
+		"\t\t\t\t\ton the device, and set \"ERROR\" when its I/O stops\n"
+		"\t\t\t\t\tcompleting for check-timeout\n"
+		"\t\t\t\t\t * It is still probed after a check that was not normal,\n"
+		"\t\t\t\t\t   when the kernel counts new I/O errors on it, and\n"
+		"\t\t\t\t\t   once every %d checks\n", "passive", 'A', PASSIVE_MAX_SKIPS);
+	fprintf(stream, "    --%s (-%c) <key>=<value>,...\tMeasure the throughput with a burst of I/O, and set\n"
+		"\t\t\t\t\tit to <attr-name>_mbps and <attr-name>_iops. Keys are\n"
+		"\t\t\t\t\t * interval=<time>: between bursts. Default=0 (not used)\n"
+		"\t\t\t\t\t   at least 60 sec, and 10 times the duration\n"
+		"\t\t\t\t\t * depth=<number>: requests in flight. Default=4\n"
+		"\t\t\t\t\t * block-size=<bytes>: Default=65536\n"
+		"\t\t\t\t\t * read=<percent>: reads among the requests. Default=100\n"
+		"\t\t\t\t\t   a read target is only read\n"
+		"\t\t\t\t\t * duration=<time[ms]>: Default=1 sec. 10 sec at most\n"
+		"\t\t\t\t\t * max-mb=<number>: MB moved at most. Default=64\n"
+		"\t\t\t\t\t * A write target writes <dir>/%s%s\n", "burst", 'G',
+		WRITE_FILE, ".burst");
+	fprintf(stream, "    --%s (-%c) <file>\t\tUnix socket to answer queries on\n", "ctl-socket", 'S');
+	fprintf(stream, "    --%s (-%c) <file>\t\tRecord each attempt in a ring file. Read it with diskd_dump\n"
+		"\t\t\t\t\t * Put it on a local disk, not on a monitored one\n"
+		"\t\t\t\t\t * Invalid at the time of the oneshot parameter designation\n", "trace", 'B');
+	fprintf(stream, "    --%s (-%c) <number>\tRecords kept in the trace file\n"
+		"\t\t\t\t\t * Default=16384 (2 MB)\n", "trace-records", 'c');
+	fprintf(stream, "    --%s (-%c) <command>\t\tQuery a running diskd through -S and exit\n"
+		"\t\t\t\t\t * status: last result of each target and its age\n"
+		"\t\t\t\t\t * stats: probe latency percentiles of each target\n"
+		"\t\t\t\t\t * histogram: latency histogram buckets of each target\n"
+		"\t\t\t\t\t * reload: read the file of -U again\n"
+		"\t\t\t\t\t * The reply is waited for the check timeout (-t)\n", "query", 'Q');
+	fprintf(stream, "\nNote: -N, -w options cannot be specified at the same time.\n");
+	fprintf(stream, "Note: <time> of -i, -j, -J, -t, -I and of the target keys is in seconds,\n"
+		"      or in milliseconds with the \"ms\" suffix (e.g. 500ms).\n\n");
 	fprintf(stream, "Advanced options\n");
-	fprintf(stream, "    --%s (-%c) <time[s]>\tDisk status check timeout for select function\n"
+	fprintf(stream, "    --%s (-%c) <time>\tDisk status check timeout for select function\n"
 		"\t\t\t\t\t * Default=60 sec.\n", "check-timeout", 't');
 	fprintf(stream, "    --%s (-%c) <times>\t\tDisk status check retry\n"
 		"\t\t\t\t\t * Default=1 times\n", "retry", 'r');
-	fprintf(stream, "    --%s (-%c) <time[s]>\tDisk status check retry interval time\n"
+	fprintf(stream, "    --%s (-%c) <time>\tDisk status check retry interval time\n"
 		"\t\t\t\t\t * Default=5 sec.\n", "retry-interval", 'I');
 
 	fflush(stream);
@@ -183,7 +386,80 @@ usage(const char *cmd, int crm_exit_status)
 }
 
 static gboolean
-check_status(int new_status)
+diskd_latency_slow(diskd_target_t *target, gint64 latency, gint64 scale_pct)
+{
+	if (target->degraded_ms > 0
+	    && latency * 100 > (gint64)target->degraded_ms * 1000 * scale_pct) {
+		return TRUE;
+	}
+	if (target->degraded_factor > 0 && target->baseline_samples >= BASELINE_MIN_SAMPLES) {
+		gint64 limit = MAX((gint64)(target->baseline * target->degraded_factor),
+			DEGRADED_MIN_LATENCY);
+
+		return latency * 100 > limit * scale_pct;
+	}
+	return FALSE;
+}
+
+/* failed (or good) cycles among the last window ones */
+int
+diskd_vote_count(const diskd_target_t *target, gboolean failed, int window)
+{
+	guint64 mask;
+
+	window = MIN(window, target->vote_count);
+	if (window <= 0) {
+		return 0;
+	}
+	mask = window >= 64 ? G_MAXUINT64 : ((guint64)1 << window) - 1;
+	if (failed) {
+		return __builtin_popcountll(target->votes & mask);
+	}
+	return __builtin_popcountll(~target->votes & mask);
+}
+
+/*
+ * Status of a successful check from its latency.  degraded is entered
+ * after degraded_count consecutive checks above the threshold, and left
+ * after as many consecutive checks below 3/4 of it.  The baseline only
+ * learns from checks that are not slow, so it does not follow a device
+ * that gets slower.
+ */
+static int
+diskd_latency_status(diskd_target_t *target)
+{
+	gint64 latency = target->last_latency;
+
+	if (latency < 0 || target->burst_run != NULL) {
+		/* passive: nothing was measured. in a burst: it measures our own load */
+		return target->is_degraded ? degraded : normal;
+	}
+	/* without thresholds nothing is slow, and only the baseline is kept */
+	if (diskd_latency_slow(target, latency, 100)) {
+		target->fast_count = 0;
+		if (!target->is_degraded && ++target->slow_count >= target->degraded_count) {
+			target->is_degraded = TRUE;
+			crm_warn("%s is slow: %lld usec (baseline %lld usec)", target->path,
+				(long long)latency, (long long)target->baseline);
+		}
+	} else {
+		target->slow_count = 0;
+		if (target->is_degraded && !diskd_latency_slow(target, latency, 75)
+		    && ++target->fast_count >= target->degraded_count) {
+			target->is_degraded = FALSE;
+			crm_notice("%s is no longer slow: %lld usec", target->path, (long long)latency);
+		}
+		if (target->baseline_samples++ == 0) {
+			target->baseline = latency;
+		} else {
+			target->baseline += (latency - target->baseline) >> BASELINE_SHIFT;
+		}
+	}
+	return target->is_degraded ? degraded : normal;
+}
+
+static gboolean
+check_status(diskd_target_t *target, int new_status)
 {
 	if (oneshot_flag) { /* oneshot */
 		return FALSE;
@@ -202,14 +478,70 @@ check_status(int new_status)
 #endif
 	}
 
+	if (target->voted) {
+		/* the timer thread has reported the cycle while its I/O hung */
+		crm_debug("The check cycle of %s has already voted", target->path);
+		if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+			g_mutex_unlock(&diskd_mutex);
+#else
+			g_mutex_unlock(diskd_mutex);
+#endif
+		}
+		return FALSE;
+	}
+	target->voted = TRUE;
+
+	/* vote with the last cycles. Only a confirmed change is published. */
+	target->votes = (target->votes << 1) | (new_status == ERROR);
+	if (target->vote_count < DISKD_VOTE_MAX) {
+		target->vote_count++;
+	}
+	if (new_status == normal) {
+		new_status = diskd_latency_status(target);
+		if (target->status == ERROR
+		    && diskd_vote_count(target, FALSE, target->recover_m) < target->recover_n) {
+			crm_info("%s succeeded in %d of the last %d check cycles, %d needed to recover",
+				target->path, diskd_vote_count(target, FALSE, target->recover_m),
+				target->recover_m, target->recover_n);
+			new_status = ERROR;
+		}
+	} else if (target->status != ERROR
+		   && diskd_vote_count(target, TRUE, target->fail_m) < target->fail_n) {
+		crm_info("%s failed in %d of the last %d check cycles, %d needed for ERROR",
+			target->path, diskd_vote_count(target, TRUE, target->fail_m),
+			target->fail_m, target->fail_n);
+		new_status = target->status;
+	}
+
+	if (new_status == ERROR && target->status != ERROR) {
+		/* how long the failure took to be reported */
+		target->error_events++;
+		diskd_hist_record(&target->detect, g_get_monotonic_time()
+			- (target->fail_since != 0 ? target->fail_since : target->probe_start));
+	} else if (new_status != ERROR && target->status == ERROR) {
+		target->recoveries++;
+	}
+
+	target->status = new_status;
+	target->result_time = g_get_monotonic_time();
 	if (new_status == ERROR) {
-		diskcheck_value = "ERROR";
+		target->value = "ERROR";
 		crm_warn("disk status is changed, attr_name=%s, target=%s, new_status=%s",
-			diskd_attr, (wflag)? wdir : device, diskcheck_value);
-	} else {
-		diskcheck_value = "normal";
+			target->attr, target->path, target->value);
+	} else if (new_status == degraded) {
+		target->value = "degraded";
+	} else if (new_status == normal) {
+		target->value = "normal";
+	}
+	if (new_status == NONE) {
+		/* the first cycles failed, but not enough to be sure. no value yet */
+	} else if (target->parent == NULL) {
+		diskd_attrd_queue(target);
+	} else if (diskd_paths_update(target->parent)) {
+		/* a path is published as the count of its device */
+		diskd_attrd_queue(target->parent);
 	}
-	send_update();
 
 	if (diskd_thread_use == TRUE) {
 #if GLIB_CHECK_VERSION(2, 32, 0)
@@ -221,8 +553,95 @@ check_status(int new_status)
 	return TRUE;
 }
 
+static void diskd_watchdog_lock(void)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	g_mutex_lock(&watchdog_mutex);
+#else
+	g_mutex_lock(watchdog_mutex);
+#endif
+}
+
+static void diskd_watchdog_unlock(void)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	g_mutex_unlock(&watchdog_mutex);
+#else
+	g_mutex_unlock(watchdog_mutex);
+#endif
+}
+
+/* Called with watchdog_mutex held. FALSE when the deadline has passed. */
+static gboolean diskd_watchdog_wait(gint64 deadline)
+{
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	if (deadline == 0) {
+		g_cond_wait(&watchdog_cond, &watchdog_mutex);
+		return TRUE;
+	}
+	return g_cond_wait_until(&watchdog_cond, &watchdog_mutex, deadline);
+#else
+	GTimeVal gtime;
+
+	if (deadline == 0) {
+		g_cond_wait(watchdog_cond, watchdog_mutex);
+		return TRUE;
+	}
+	g_get_current_time(&gtime);
+	g_time_val_add(&gtime, MAX(deadline - g_get_monotonic_time(), 0));
+	return g_cond_timed_wait(watchdog_cond, watchdog_mutex, &gtime);
+#endif
+}
+
+/*
+ * The timer thread.  It sleeps until a check is armed, then until its
+ * deadline.  A disarm (or a new arm) bumps watchdog_gen, so a wakeup for
+ * a check that has already finished is recognized and ignored.  When the
+ * deadline passes, it reports the cycle as ERROR itself, as the main loop
+ * is blocked in the I/O.  The cycle has then voted, and its late end does
+ * not vote again.
+ */
+static gpointer diskd_thread_timer_func(gpointer data)
+{
+	diskd_watchdog_lock();
+	while (!watchdog_quit) {
+		diskd_target_t *target = watchdog_target;
+		guint64 gen = watchdog_gen;
+
+		if (target == NULL) {
+			diskd_watchdog_wait(0);
+			continue;
+		}
+		if (diskd_watchdog_wait(watchdog_deadline) || gen != watchdog_gen) {
+			continue;
+		}
+		/* fires once per arm */
+		watchdog_target = NULL;
+		watchdog_fired = TRUE;
+		watchdog_publishing = TRUE;
+		diskd_watchdog_unlock();
+
+		crm_warn("Timeout Error(s) occurred in diskd timer thread.");
+		crm_err("The check of %s did not complete within %d ms", target->path,
+			target->timeout);
+		check_status(target, ERROR);
+
+		diskd_watchdog_lock();
+		watchdog_publishing = FALSE;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_cond_broadcast(&watchdog_cond);
+#else
+		g_cond_broadcast(watchdog_cond);
+#endif
+	}
+	diskd_watchdog_unlock();
+	return GINT_TO_POINTER(normal);
+}
+
 static void diskd_thread_timer_init()
 {
+	GError *gerr = NULL;
+
 	if (exec_thread_flag == 0) return;
 
 #if GLIB_CHECK_VERSION(2, 32, 0)
@@ -230,12 +649,9 @@ static void diskd_thread_timer_init()
 	 * When g_mutex_init() and g_cond_init() fails, it will call abort().
 	 * https://git.gnome.org/browse/glib/tree/glib/gthread-posix.c?h=glib-2-32
 	 */
-	g_mutex_init(&thread_start_mutex);
-	g_cond_init(&thread_start_cond);
 	g_mutex_init(&diskd_mutex);
-	g_cond_init(&diskd_cond);
-
-	diskd_thread_use = TRUE;
+	g_mutex_init(&watchdog_mutex);
+	g_cond_init(&watchdog_cond);
 #else
 	if (g_thread_supported()) {
 		crm_warn("The thread timer of diskd is not supported. By this system,"
@@ -243,390 +659,2119 @@ static void diskd_thread_timer_init()
 		return;
 	}
 	g_thread_init(NULL);
-	thread_start_mutex = g_mutex_new();
-	thread_start_cond = g_cond_new();
 	diskd_mutex = g_mutex_new();
-	diskd_cond = g_cond_new();
+	watchdog_mutex = g_mutex_new();
+	watchdog_cond = g_cond_new();
 
-	if (diskd_mutex && diskd_cond && thread_start_mutex && thread_start_cond) {
-		diskd_thread_use = TRUE;
-	} else {
+	if (diskd_mutex == NULL || watchdog_mutex == NULL || watchdog_cond == NULL) {
 		diskd_thread_timer_variable_free();
 		crm_warn("Failed in the generation of the thread variable."
 			" The thread timer is not available.");
+		return;
 	}
 #endif
+
+	watchdog_quit = FALSE;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	th_timer = g_thread_try_new("diskd-timer", diskd_thread_timer_func, NULL, &gerr);
+#else
+	th_timer = g_thread_create(diskd_thread_timer_func, NULL, TRUE, &gerr);
+#endif
+	if (th_timer == NULL) {
+		crm_err("Cannot create diskd timer_thread. %s", gerr->message);
+		g_error_free(gerr);
+		diskd_thread_timer_variable_free();
+		return;
+	}
+	diskd_thread_use = TRUE;
 }
 
 static void diskd_thread_timer_variable_free()
 {
 #if GLIB_CHECK_VERSION(2, 32, 0)
 	g_mutex_clear(&diskd_mutex);
-	g_mutex_clear(&thread_start_mutex);
-	g_cond_clear(&diskd_cond);
-	g_cond_clear(&thread_start_cond);
+	g_mutex_clear(&watchdog_mutex);
+	g_cond_clear(&watchdog_cond);
 #else
 	if (diskd_mutex != NULL) {
 		g_mutex_free(diskd_mutex);
 		diskd_mutex = NULL;
 	}
-	if (thread_start_mutex != NULL) {
-		g_mutex_free(thread_start_mutex);
-		thread_start_mutex = NULL;
+	if (watchdog_mutex != NULL) {
+		g_mutex_free(watchdog_mutex);
+		watchdog_mutex = NULL;
 	}
-	if (diskd_cond != NULL) {
-		g_cond_free(diskd_cond);
-		diskd_cond = NULL;
-	}
-	if (thread_start_cond != NULL) {
-		g_cond_free(thread_start_cond);
-		thread_start_cond = NULL;
+	if (watchdog_cond != NULL) {
+		g_cond_free(watchdog_cond);
+		watchdog_cond = NULL;
 	}
 #endif
 }
 
 static void diskd_thread_timer_end()
-{
-	if (diskd_thread_use == FALSE) return;
-
-	diskd_thread_timer_variable_free();
-}
-
-static void diskd_thread_condsend()
 {
 	gpointer ret_thread;
 
 	if (diskd_thread_use == FALSE) return;
 
+	diskd_watchdog_lock();
+	watchdog_quit = TRUE;
+	watchdog_target = NULL;
+	watchdog_gen++;
 #if GLIB_CHECK_VERSION(2, 32, 0)
-	g_mutex_lock(&diskd_mutex);
-	g_cond_broadcast(&diskd_cond);
-	g_mutex_unlock(&diskd_mutex);
+	g_cond_signal(&watchdog_cond);
 #else
-	if (diskd_mutex == NULL || diskd_cond == NULL) {
-		crm_warn("Cannot transmit cond to a thread");
-		return;
-	}
-	g_mutex_lock(diskd_mutex);
-	g_cond_broadcast(diskd_cond);
-	g_mutex_unlock(diskd_mutex);
+	g_cond_signal(watchdog_cond);
 #endif
+	diskd_watchdog_unlock();
 
-	if (th_timer != NULL) {
-		ret_thread = g_thread_join(th_timer);
-		crm_trace("thread_join -> %d", GPOINTER_TO_INT(ret_thread));
-		th_timer = NULL;
-	}
+	ret_thread = g_thread_join(th_timer);
+	crm_trace("thread_join -> %d", GPOINTER_TO_INT(ret_thread));
+	th_timer = NULL;
+	diskd_thread_use = FALSE;
+
+	diskd_thread_timer_variable_free();
 }
 
-static void diskd_thread_timer_func(gpointer data)
+/* Start watching a check of the target. Its deadline is the target timeout. */
+static void diskd_thread_arm(diskd_target_t *target)
 {
-	gboolean bret;
+	if (diskd_thread_use == FALSE) return;
 
+	diskd_watchdog_lock();
+	watchdog_target = target;
+	watchdog_fired = FALSE;
+	watchdog_deadline = g_get_monotonic_time() + (gint64)target->timeout * 1000;
+	watchdog_gen++;
 #if GLIB_CHECK_VERSION(2, 32, 0)
-	gint64 end_time;
-
-	g_mutex_lock(&thread_start_mutex);
-
-	/* Awaiting a start */
-	g_mutex_lock(&diskd_mutex);
-
-	/* A calculation of the waiting time */
-	end_time = g_get_monotonic_time() + timeout * G_TIME_SPAN_SECOND;
-
-	g_cond_signal(&thread_start_cond);
-
-	g_mutex_unlock(&thread_start_mutex);
-
-	bret = g_cond_wait_until(&diskd_cond, &diskd_mutex, end_time);
-	g_mutex_unlock(&diskd_mutex);
+	g_cond_signal(&watchdog_cond);
 #else
-	GTimeVal gtime;
-	glong add_time = (timeout) * 1000 * 1000;
-
-	g_mutex_lock(thread_start_mutex);
-
-	/* Awaiting a start */
-	g_mutex_lock(diskd_mutex);
-
-	/* A calculation of the waiting time and practice of the timer.(mergin 1s) */
-	g_get_current_time(&gtime);
-	g_time_val_add(&gtime, add_time);
+	g_cond_signal(watchdog_cond);
+#endif
+	diskd_watchdog_unlock();
+}
 
-	g_cond_signal(thread_start_cond);
+/* Called with watchdog_mutex held. Wait until the thread has reported a timeout. */
+static void diskd_thread_wait_published(void)
+{
+	while (watchdog_publishing) {
+		diskd_watchdog_wait(0);
+	}
+}
 
-	g_mutex_unlock(thread_start_mutex);
+/*
+ * The check has finished.  The thread is not woken up; it notices the
+ * new generation when its wait ends, or waits for the next arm instead.
+ * Returns TRUE if the check missed its deadline, once the thread has
+ * reported it.
+ */
+static gboolean diskd_thread_disarm()
+{
+	gboolean fired;
+
+	if (diskd_thread_use == FALSE) return FALSE;
+
+	diskd_watchdog_lock();
+	diskd_thread_wait_published();
+	fired = watchdog_fired;
+	watchdog_target = NULL;
+	watchdog_fired = FALSE;
+	watchdog_gen++;
+	diskd_watchdog_unlock();
+	return fired;
+}
 
-	bret = g_cond_timed_wait(diskd_cond, diskd_mutex, &gtime);
-	g_mutex_unlock(diskd_mutex);
-#endif
+/*
+ * target is freed. The thread must not keep it, even if it is armed, and
+ * a report of it that is in flight is waited for.
+ */
+static void diskd_thread_release(diskd_target_t *target)
+{
+	if (diskd_thread_use == FALSE) return;
 
-	if (bret == FALSE){
-		crm_warn("Timeout Error(s) occurred in diskd timer thread.");
-		check_status(ERROR);
-		g_thread_exit(GINT_TO_POINTER(ERROR));
+	diskd_watchdog_lock();
+	diskd_thread_wait_published();
+	if (watchdog_target == target) {
+		watchdog_target = NULL;
+		watchdog_fired = FALSE;
+		watchdog_gen++;
 	}
-	crm_trace("Received Cond from Main().");
-	g_thread_exit(GINT_TO_POINTER(normal));
+	diskd_watchdog_unlock();
 }
 
-static void diskd_thread_create()
+/* Record the time since "since" for the phase. Returns the current time. */
+static gint64 diskd_probe_mark(diskd_target_t *target, enum diskd_phase phase, gint64 since)
 {
-	GError *gerr = NULL;
+	gint64 now = g_get_monotonic_time();
 
-	if (diskd_thread_use == FALSE) return;
+	diskd_hist_record(&target->hist[phase], now - since);
+	target->last_phase[phase] = now - since;
+	return now;
+}
 
-#if GLIB_CHECK_VERSION(2, 32, 0)
-	g_mutex_lock(&thread_start_mutex);
+static gint64 diskd_probe_begin(diskd_target_t *target)
+{
+	int i;
 
-	if (th_timer == NULL) {
-		th_timer = g_thread_try_new(NULL, (GThreadFunc)diskd_thread_timer_func, NULL, &gerr);
-		if (th_timer == NULL) {
-			crm_err("Cannot create diskd timer_thread. %s", gerr->message);
-			g_error_free(gerr);
-			diskd_thread_use = FALSE;
-			g_mutex_unlock(&thread_start_mutex);
-		}
+	target->probes++;
+	for (i = 0; i < DISKD_PHASE_MAX; i++) {
+		target->last_phase[i] = -1;
 	}
+	target->last_error = 0;
+	target->timed_out = FALSE;
+	target->probe_start = g_get_monotonic_time();
+	return target->probe_start;
+}
 
-	if (th_timer != NULL) {
-		g_cond_wait(&thread_start_cond, &thread_start_mutex);
-		g_mutex_unlock(&thread_start_mutex);
+/* Close fd, remove the write check file, and time it with the whole attempt. */
+static void diskd_probe_close(diskd_target_t *target, int fd, const char *file, gint64 since)
+{
+	close(fd);
+	if (file != NULL && -1 == remove(file)) {
+		crm_warn("failed to remove file %s", file);
 	}
-#else
-	g_mutex_lock(thread_start_mutex);
+	since = diskd_probe_mark(target, diskd_phase_close, since);
+	target->last_latency = since - target->probe_start;
+	target->last_phase[diskd_phase_total] = target->last_latency;
+	diskd_hist_record(&target->hist[diskd_phase_total], target->last_latency);
+}
 
-	if (th_timer == NULL) {
-		th_timer = g_thread_create((GThreadFunc)diskd_thread_timer_func, NULL, TRUE, &gerr);
-		if (th_timer == NULL) {
-			crm_err("Cannot create diskd timer_thread. %s", gerr->message);
-			g_error_free(gerr);
-			diskd_thread_use = FALSE;
-			g_mutex_unlock(thread_start_mutex);
-		}
+/* The file the write check removes after each attempt, if any. */
+static const char *diskd_probe_file(diskd_target_t *target)
+{
+	if (target->type == diskd_probe_write && target->write_mode == diskd_write_create) {
+		return target->wfile;
 	}
+	return NULL;
+}
+
+/* One attempt of the write check in the slots mode. */
+static int diskcheck_slot(diskd_target_t *target)
+{
+	int fd;
+	gint64 t;
+
+	crm_trace("diskcheck_slot start");
 
-	if (th_timer != NULL) {
-		g_cond_wait(thread_start_cond, thread_start_mutex);
-		g_mutex_unlock(thread_start_mutex);
+	t = diskd_probe_begin(target);
+	fd = diskd_slot_open(target);
+	t = diskd_probe_mark(target, diskd_phase_open, t);
+	if (fd == -1) {
+		target->last_error = errno;
+		crm_perror(LOG_ERR, "Could not open %s", target->wfile);
+		return ERROR;
 	}
-#endif
+	if (diskd_slot_write(target, fd) < 0) {
+		target->last_error = errno;
+		crm_perror(LOG_ERR, "Could not %s file %s",
+			target->verify ? "write and read back" : "write to", target->wfile);
+		t = diskd_probe_mark(target, diskd_phase_io, t);
+		diskd_probe_close(target, fd, NULL, t);
+		return ERROR;
+	}
+	t = diskd_probe_mark(target, diskd_phase_io, t);
+	diskd_probe_close(target, fd, NULL, t);
+	return normal;
 }
 
-static int diskcheck_wt(gpointer data)
+/* One attempt of the write check. Returns normal or ERROR. */
+static int diskcheck_wt(diskd_target_t *target)
 {
+	const char *wfile = target->wfile;
 	int fd = -1;
-	int err, i;
+	int err;
 	int select_err;
+	gint64 t;
 	struct timeval timeout_tv;
 	fd_set write_fd_set;
 
 	crm_trace("diskcheck_wt start");
 
-	diskd_thread_create();
-
-	for (i = 0; i <= retry; i++) {
-		if ( i != 0 ) {
-			sleep(retry_interval);
-		}
-
-		/* file open */
-		fd = open(wfile, O_WRONLY | O_CREAT | O_DSYNC | O_NONBLOCK, 0);
-		if (fd == -1) {
-			crm_err("Could not open %s", wfile);
-			crm_perror(LOG_ERR, "%s", wfile);
-			continue;  /* failed to open file. try re-open */
-		}
+	/* file open */
+	t = diskd_probe_begin(target);
+	fd = open(wfile, O_WRONLY | O_CREAT | O_DSYNC | O_NONBLOCK, 0);
+	t = diskd_probe_mark(target, diskd_phase_open, t);
+	if (fd == -1) {
+		target->last_error = errno;
+		crm_err("Could not open %s", wfile);
+		crm_perror(LOG_ERR, "%s", wfile);
+		return ERROR;
+	}
 
-		while( 1 ) {
-			err = write(fd, buf, WRITE_DATA);  /* data write */
-			if (err == WRITE_DATA) {
-				crm_trace("data writing is OK");
-				close(fd);
-				if (-1 == remove((const char *)wfile)) {
-					crm_warn("failed to remove file %s", wfile);
-				}
-				diskd_thread_condsend();
-				check_status(normal);
-				return normal;  /* OK */
-			} else if (err != WRITE_DATA && errno == EAGAIN) {
-				crm_warn("write function return errno:EAGAIN");
-				FD_ZERO(&write_fd_set);
-				FD_SET(fd, &write_fd_set);
-				timeout_tv.tv_sec = timeout;
-				timeout_tv.tv_usec = 0;
-				select_err = select(fd+1, NULL, &write_fd_set, NULL, &timeout_tv);
-				if (select_err == 1) {
-					crm_warn("select ok, write again");
-					continue;  /* retly write */
-				} else if (select_err == -1) {
-					crm_err("select failed on file %s", wfile);
-					close(fd);
-					if (-1 == remove((const char *)wfile)) {
-						crm_warn("failed to remove file %s", wfile);
-					}
-					break;  /* failed to select */
-				} else {
-					crm_err("select time out on file %s", wfile);
-					close(fd);
-					if (-1 == remove((const char *)wfile)) {
-						crm_warn("failed to remove file %s", wfile);
-					}
-					break;  /* failed to select */
-				}
+	while( 1 ) {
+		err = write(fd, target->buf, WRITE_DATA);  /* data write */
+		t = diskd_probe_mark(target, diskd_phase_io, t);
+		if (err == WRITE_DATA) {
+			crm_trace("data writing is OK");
+			diskd_probe_close(target, fd, wfile, t);
+			return normal;  /* OK */
+		} else if (err != WRITE_DATA && errno == EAGAIN) {
+			crm_warn("write function return errno:EAGAIN");
+			FD_ZERO(&write_fd_set);
+			FD_SET(fd, &write_fd_set);
+			timeout_tv.tv_sec = target->timeout / 1000;
+			timeout_tv.tv_usec = (target->timeout % 1000) * 1000;
+			select_err = select(fd+1, NULL, &write_fd_set, NULL, &timeout_tv);
+			if (select_err == 1) {
+				crm_warn("select ok, write again");
+				continue;  /* retly write */
+			} else if (select_err == -1) {
+				target->last_error = errno;
+				crm_err("select failed on file %s", wfile);
 			} else {
-				crm_err("Could not write to file %s", wfile);
-				crm_perror(LOG_ERR, "%s", wfile);
-				close(fd);
-				if (-1 == remove((const char *)wfile)) {
-					crm_warn("failed to remove file %s", wfile);
-				}
-				break;  /* failed to write */
+				target->last_error = ETIMEDOUT;
+				crm_err("select time out on file %s", wfile);
 			}
+			diskd_probe_close(target, fd, wfile, g_get_monotonic_time());
+			return ERROR;  /* failed to select */
+		} else {
+			target->last_error = (err < 0) ? errno : EIO;
+			crm_err("Could not write to file %s", wfile);
+			crm_perror(LOG_ERR, "%s", wfile);
+			diskd_probe_close(target, fd, wfile, t);
+			return ERROR;  /* failed to write */
 		}
 	}
-	/* after for loop */
-
-	diskd_thread_condsend();
-
-	crm_warn("Error(s) occurred in diskcheck_wt function.");
-	check_status(ERROR);
-
-	return ERROR;
 }
 
-static int diskcheck(gpointer data)
+/* One attempt of the read check. Returns normal or ERROR. */
+static int diskcheck(diskd_target_t *target)
 {
-	int i;
+	const char *device = target->path;
 	int fd = -1;
-	int err;
+	int err, i, n;
 	int select_err;
+	gint64 t;
 	struct timeval timeout_tv;
 	fd_set read_fd_set;
 
 	crm_trace("diskcheck start");
 
-	diskd_thread_create();
+	t = diskd_probe_begin(target);
+	fd = open((const char *)device, O_RDONLY | O_NONBLOCK | O_DIRECT, 0);
+	t = diskd_probe_mark(target, diskd_phase_open, t);
+	if (fd == -1) {
+		target->last_error = errno;
+		crm_err("Could not open device %s", device);
+		return ERROR;
+	}
+	n = diskd_sample_plan(target, fd);
+	if (n < 0) {
+		target->last_error = errno;
+		diskd_probe_close(target, fd, NULL, t);
+		return ERROR;
+	}
 
-	for (i = 0; i <= retry; i++) {
-		if ( i != 0 ) {
-			sleep(retry_interval);
-		}
+	for (i = 0; i < n; ) {
+		diskd_aio_seg_t *seg = &target->segs[i];
 
-		fd = open((const char *)device, O_RDONLY | O_NONBLOCK | O_DIRECT, 0);
-		if (fd == -1) {
-			crm_err("Could not open device %s", device);
+		err = pread(fd, seg->buf, seg->len, seg->offset);
+		if (err == (int)seg->len) {
+			i++;
 			continue;
-		}
-
-		while( 1 ) {
-			err = read(fd, buf, pagesize);
-			if (err == pagesize) {
-				crm_trace("reading form data is OK");
-				close(fd);
-				diskd_thread_condsend();
-				check_status(normal);
-				return normal;
-			} else if (err != pagesize && errno == EAGAIN) {
-				crm_warn("read function return errno:EAGAIN");
-				FD_ZERO(&read_fd_set);
-				FD_SET(fd, &read_fd_set);
-				timeout_tv.tv_sec = timeout;
-				timeout_tv.tv_usec = 0;
-				select_err = select(fd+1, &read_fd_set, NULL, NULL, &timeout_tv);
-				if (select_err == 1) {
-					crm_warn("select ok, read again");
-					continue;
-				} else if (select_err == -1) {
-					crm_err("select failed on device %s", device);
-					close(fd);
-					break;
-				}
+		} else if (err < 0 && errno == EAGAIN) {
+			crm_warn("read function return errno:EAGAIN");
+			FD_ZERO(&read_fd_set);
+			FD_SET(fd, &read_fd_set);
+			timeout_tv.tv_sec = target->timeout / 1000;
+			timeout_tv.tv_usec = (target->timeout % 1000) * 1000;
+			select_err = select(fd+1, &read_fd_set, NULL, NULL, &timeout_tv);
+			if (select_err == 1) {
+				crm_warn("select ok, read again");
+				continue;
+			} else if (select_err == -1) {
+				target->last_error = errno;
+				crm_err("select failed on device %s", device);
 			} else {
-				crm_err("Could not read from device %s", device);
-				close(fd);
-				break;
+				target->last_error = ETIMEDOUT;
+				crm_err("select time out on device %s", device);
 			}
+			diskd_probe_close(target, fd, NULL, g_get_monotonic_time());
+			return ERROR;
+		} else {
+			target->last_error = (err < 0) ? errno : EIO;
+			crm_err("Could not read from device %s at offset %lld", device,
+				(long long)seg->offset);
+			t = diskd_probe_mark(target, diskd_phase_io, t);
+			diskd_probe_close(target, fd, NULL, t);
+			return ERROR;
 		}
 	}
-	diskd_thread_condsend();
-
-	crm_warn("Error(s) occurred in diskcheck function.");
-	check_status(ERROR);
+	crm_trace("reading form data is OK");
+	t = diskd_probe_mark(target, diskd_phase_io, t);
+	diskd_probe_close(target, fd, NULL, t);
+	return normal;
+}
 
-	return ERROR;
+static int diskd_sync_attempt(diskd_target_t *target)
+{
+	if (target->type == diskd_probe_write) {
+		if (target->write_mode == diskd_write_slots) {
+			return diskcheck_slot(target);
+		}
+		return diskcheck_wt(target);
+	}
+	return diskcheck(target);
 }
 
-static int oneshot(void)
+/*
+ * Schedule the next cycle one interval after the due time of the one
+ * that started last, so that the cycles do not drift.  Cycles missed
+ * while the main loop was blocked are skipped.  When the interval has
+ * shrunk, this moves a cycle already queued nearer, never further.
+ */
+static void diskd_target_schedule(diskd_target_t *target)
 {
-	int rc = 0;
+	gint64 now = g_get_monotonic_time();
+	gint64 step = (gint64)target->cur_interval * 1000;
+	gint64 due = target->last_started + step;
+
+	if (due <= now) {
+		due += ((now - due) / step + 1) * step;
+	}
+	if (target->due != 0 && target->due <= due) {
+		return;
+	}
+	diskd_sched_add(target, due);
+}
 
-	if ( wflag ) {	/* writer */
-		if (wfile == NULL) {
-			wdir = strdup(WRITE_DIR);
-			wfile = calloc(1, PATH_MAX);
-			g_snprintf(wfile, PATH_MAX, "%s/%s", WRITE_DIR, WRITE_FILE);
+/* TRUE when the kernel has counted I/O errors on the device since the last call. */
+static gboolean diskd_target_ioerr(diskd_target_t *target)
+{
+	char buf[32];
+	guint64 cnt;
+	gboolean changed;
+	ssize_t len;
+	int fd;
+
+	if (target->ioerr_path == NULL) {
+		struct stat st;
+		dev_t dev;
+		int i;
+
+		if (stat(target->path, &st) < 0) {
+			return FALSE;
 		}
-		buf = (void *)malloc(WRITE_DATA);
-		if (buf == NULL) {
-			crm_err("Could not allocate memory");
-			crm_exit(1);
+		dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+		/* a partition has the counter of its disk */
+		for (i = 0; i < 2 && target->ioerr_path == NULL; i++) {
+			char *path = g_strdup_printf("/sys/dev/block/%u:%u/%sdevice/ioerr_cnt",
+				major(dev), minor(dev), (i == 0)? "" : "../");
+
+			if (access(path, R_OK) == 0) {
+				target->ioerr_path = strdup(path);
+			}
+			g_free(path);
 		}
-		rc = diskcheck_wt(NULL);
-		free(wfile);
-	} else {	/* reader */
-		pagesize = getpagesize();
-		ptr = (void *)malloc(2 * pagesize);
-		if (ptr == NULL) {
-			crm_err("Could not allocate memory");
-			crm_exit(1);
+		if (target->ioerr_path == NULL) {
+			target->ioerr_path = strdup("");
 		}
-		buf = (void *)(((u_long)ptr + pagesize) & ~(pagesize-1));
-		rc = diskcheck(NULL);
-		free(ptr);
+		target->ioerr_cnt = G_MAXUINT64;
+	}
+	if (target->ioerr_path[0] == '\0') {
+		return FALSE;
 	}
 
-	if (rc == ERROR) {
-		return ERROR;
+	fd = open(target->ioerr_path, O_RDONLY);
+	if (fd < 0) {
+		return FALSE;
 	}
-	return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return FALSE;
+	}
+	buf[len] = '\0';
+	cnt = g_ascii_strtoull(buf, NULL, 0);
+	changed = (target->ioerr_cnt != G_MAXUINT64 && cnt != target->ioerr_cnt);
+	target->ioerr_cnt = cnt;
+	return changed;
 }
 
-int
-main(int argc, char **argv)
+/*
+ * Pick the interval after a check cycle ended.  Any sign of trouble - a
+ * failed attempt, ERROR, degraded, a latency spike or new kernel I/O
+ * errors - drops it to min-interval at once.  Each healthy cycle then
+ * stretches it by half, up to max-interval.
+ */
+static void diskd_target_adapt(diskd_target_t *target, gboolean trouble)
 {
-	int argerr = 0;
-	int flag;
-	char *pid_file = NULL;
-	gboolean daemonize = FALSE;
+	int next;
 
-#ifdef HAVE_GETOPT_H
-	int option_index = 0;
-	static struct option long_options[] = {
-		/* Top-level Options */
-		{"verbose", 0, 0, 'V'},
-		{"help", 0, 0, '?'},
-		{"pid-file", 1, 0, 'p'},
-		{"attr-name", 1, 0, 'a'},
-		{"read-device-name", 1, 0, 'N'},
-		{"daemonize", 0, 0, 'D'},
-		{"interval", 1, 0, 'i'},
-		{"retry", 1, 0, 'r'},
-		{"retry-interval", 1, 0, 'I'},
-		{"check-timeout", 1, 0, 't'},
-		{"write-check", 0, 0, 'w'},		/* add option 2008.10.24 */
-		{"write-directory-name", 1, 0, 'd'},	/* add option 2009.4.17 */
-		{"oneshot", 0, 0, 'o'},			/* add option 2009.10.01 */
-		{"exec-thread", 0, 0, 'e'},		/* add option 2011.09.30 */
-		{"dampen", 1, 0, 'm'},
+	if (target->min_interval == target->max_interval) {
+		return;
+	}
+	if (diskd_target_ioerr(target) || target->ioerr_pending) {
+		crm_info("The kernel reported I/O errors on %s", target->path);
+		trouble = TRUE;
+	}
+	target->ioerr_pending = FALSE;
+	if (target->status == ERROR || target->status == degraded || target->attempt > 0) {
+		trouble = TRUE;
+	}
+	if (target->baseline_samples >= BASELINE_MIN_SAMPLES
+	    && target->last_latency > MAX(target->baseline * SPIKE_FACTOR, DEGRADED_MIN_LATENCY)) {
+		trouble = TRUE;
+	}
 
-		{0, 0, 0, 0}
-	};
-#endif
-	pid_file = strdup(PID_FILE);
-	crm_system_name = strdup(basename(argv[0]));
+	if (trouble) {
+		next = target->min_interval;
+	} else {
+		next = MIN(target->cur_interval + MAX(target->cur_interval / 2, MIN_INTERVAL),
+			target->max_interval);
+	}
+	if (next < target->cur_interval) {
+		crm_debug("Checking %s every %d ms", target->path, next);
+		target->cur_interval = next;
+		diskd_target_schedule(target);
+	} else {
+		target->cur_interval = next;
+	}
+}
 
-	mainloop_add_signal(SIGTERM, diskd_shutdown);
+/*
+ * A check cycle is a small state machine per target: an attempt, and on
+ * failure a main loop timer for the next one after retry_interval.  No
+ * attempt waits for another target, and signals are handled in between.
+ */
+static void diskd_check_attempt(diskd_target_t *target);
+
+static gboolean diskd_check_retry(gpointer data)
+{
+	diskd_target_t *target = data;
+
+	target->retry_id = 0;
+	diskd_check_attempt(target);
+	return FALSE;
+}
+
+/* Take the completions of our own probe out of the next passive check. */
+static void diskd_passive_sample(diskd_target_t *target)
+{
+	guint64 done, inflight;
+
+	if (target->passive && diskd_stat_read(target, &done, &inflight) == 0) {
+		target->stat_done = done;
+		target->stat_time = g_get_monotonic_time();
+		target->stat_sampled = TRUE;
+	}
+}
+
+/*
+ * Decide a check cycle from the I/O of others on the device.
+ * Returns TRUE if it needs no probe.  Requests that fail are counted as
+ * completed too, so a device is still probed after a cycle that was not
+ * normal, when the kernel counts new I/O errors on it, and every
+ * PASSIVE_MAX_SKIPS cycles.
+ */
+static gboolean diskd_passive_check(diskd_target_t *target)
+{
+	guint64 done, inflight, last_done = target->stat_done;
+	gint64 now = g_get_monotonic_time(), last_time = target->stat_time;
+	gboolean sampled = target->stat_sampled;
+
+	if (diskd_stat_read(target, &done, &inflight) < 0) {
+		return FALSE;
+	}
+	target->stat_done = done;
+	target->stat_time = now;
+	target->stat_sampled = TRUE;
+	if (!sampled) {
+		return FALSE;
+	}
+
+	if (diskd_target_ioerr(target)) {
+		crm_info("The kernel reported I/O errors on %s, probing it", target->path);
+		target->ioerr_pending = TRUE;
+		target->stall_since = 0;
+		return FALSE;
+	}
+	if (done != last_done && (target->status == ERROR || target->status == degraded
+				  || target->passive_run >= PASSIVE_MAX_SKIPS)) {
+		target->stall_since = 0;
+		return FALSE;
+	}
+	if (done != last_done) {
+		/* the device completed requests since the last cycle */
+		crm_trace("%s completed %llu requests, not probed", target->path,
+			(unsigned long long)(done - last_done));
+		target->stall_since = 0;
+		target->passive_skips++;
+		target->passive_run++;
+		target->last_latency = -1;
+		target->fail_since = 0;
+		check_status(target, normal);
+		diskd_trace_record(target, diskd_trace_passive, 0);
+		diskd_target_adapt(target, FALSE);
+		return TRUE;
+	}
+	if (inflight == 0) {
+		target->stall_since = 0;
+		return FALSE;	/* idle. probe it */
+	}
+
+	/* requests are in flight, and none completed since the last sample */
+	if (target->stall_since == 0) {
+		target->stall_since = last_time;
+	}
+	if (now - target->stall_since < (gint64)target->timeout * 1000) {
+		crm_debug("%s has %llu requests in flight and completes none", target->path,
+			(unsigned long long)inflight);
+		diskd_trace_record(target, diskd_trace_stall, 0);
+		diskd_target_adapt(target, TRUE);
+		return TRUE;
+	}
+	if (target->status != ERROR) {
+		target->stalls++;
+		crm_err("%s has had %llu requests in flight without a completion for %lld sec",
+			target->path, (unsigned long long)inflight,
+			(long long)((now - target->stall_since) / G_TIME_SPAN_SECOND));
+	}
+	target->fail_since = target->stall_since;
+	check_status(target, ERROR);
+	diskd_trace_record(target, diskd_trace_stall, ETIMEDOUT);
+	diskd_target_adapt(target, TRUE);
+	return TRUE;
+}
+
+/* The attempt finished: end the cycle, or schedule the next attempt. */
+static void diskd_check_done(diskd_target_t *target, int rc)
+{
+	if (rc == normal) {
+		target->probes_ok++;
+		target->fail_since = 0;
+		target->busy = FALSE;
+		diskd_passive_sample(target);
+		check_status(target, normal);
+		diskd_trace_record(target, diskd_trace_ok, 0);
+		diskd_target_adapt(target, FALSE);
+		return;
+	}
+	if (target->last_error == 0) {
+		target->last_error = EIO;
+	}
+	if (target->fail_since == 0) {
+		target->fail_since = target->probe_start;
+	}
+	if (target->attempt < target->retry && !target->voted) {
+		diskd_trace_record(target, target->timed_out ? diskd_trace_timeout : diskd_trace_error,
+			target->last_error);
+		target->attempt++;
+		target->retry_id = g_timeout_add(target->retry_interval, diskd_check_retry, target);
+		return;
+	}
+	target->busy = FALSE;
+	diskd_passive_sample(target);
+	crm_warn("Error(s) occurred in the check of %s.", target->path);
+	check_status(target, ERROR);
+	diskd_trace_record(target, target->timed_out ? diskd_trace_timeout : diskd_trace_error,
+		target->last_error);
+	diskd_target_adapt(target, TRUE);
+}
+
+/*
+ * The deadline of an attempt.  Its source is made by the first attempt of
+ * the target and armed again by each later one, so that a check cycle does
+ * not allocate a new timer.
+ */
+#if GLIB_CHECK_VERSION(2, 36, 0)
+static gboolean diskd_deadline_dispatch(GSource *source, GSourceFunc callback, gpointer data)
+{
+	g_source_set_ready_time(source, -1);
+	callback(data);
+	return TRUE;	/* kept for the next attempt */
+}
+
+static GSourceFuncs diskd_deadline_funcs = { NULL, NULL, diskd_deadline_dispatch, NULL };
+#endif
+
+static void diskd_deadline_arm(diskd_target_t *target, GSourceFunc fn)
+{
+#if GLIB_CHECK_VERSION(2, 36, 0)
+	if (target->deadline == NULL) {
+		target->deadline = g_source_new(&diskd_deadline_funcs, sizeof(GSource));
+		g_source_set_callback(target->deadline, fn, target, NULL);
+		g_source_attach(target->deadline, NULL);
+	}
+	g_source_set_ready_time(target->deadline,
+		g_get_monotonic_time() + (gint64)target->timeout * 1000);
+	target->deadline_id = g_source_get_id(target->deadline);
+#else
+	target->deadline_id = g_timeout_add(target->timeout, fn, target);
+#endif
+}
+
+static void diskd_deadline_cancel(diskd_target_t *target)
+{
+	if (target->deadline_id == 0) {
+		return;
+	}
+#if GLIB_CHECK_VERSION(2, 36, 0)
+	g_source_set_ready_time(target->deadline, -1);
+#else
+	g_source_remove(target->deadline_id);
+#endif
+	target->deadline_id = 0;
+}
+
+static void diskd_async_done(diskd_target_t *target, int fd, int error)
+{
+	gint64 t;
+
+	if (error == 0 && target->verify) {
+		if (!target->verifying) {
+			/* written. read it back within the same deadline */
+			diskd_aio_seg_t seg = target->vseg;
+
+			seg.buf = target->vbuf;
+			seg.rw_flags = 0;
+			target->verifying = TRUE;
+			if (diskd_aio_submit(target, fd, FALSE, &seg, 1, diskd_async_done) == 0) {
+				return;
+			}
+			error = errno;
+		} else if (diskd_slot_verify(target) < 0) {
+			error = EIO;
+		}
+		target->verifying = FALSE;
+	}
+	diskd_deadline_cancel(target);
+	t = diskd_probe_mark(target, diskd_phase_io, target->probe_mark);
+	diskd_probe_close(target, fd, diskd_probe_file(target), t);
+	target->last_error = error;
+
+	if (error == 0) {
+		crm_trace("%s of %s is OK",
+			(target->type == diskd_probe_write)? "writing" : "reading", target->path);
+		diskd_check_done(target, normal);
+		return;
+	}
+	crm_err("Could not %s %s: %s",
+		(target->type == diskd_probe_write)? "write to" : "read from",
+		target->path, strerror(error));
+	diskd_check_done(target, ERROR);
+}
+
+/* A failed attempt like any other: retried while the retries last. */
+static gboolean diskd_async_deadline(gpointer data)
+{
+	diskd_target_t *target = data;
+
+	target->deadline_id = 0;
+	target->timeouts++;
+	target->timed_out = TRUE;
+	target->last_error = ETIMEDOUT;
+	crm_err("I/O on %s did not complete within %d ms", target->path, target->timeout);
+	/* a retry finds the I/O outstanding and fails, until it completes */
+	diskd_aio_abandon(target);
+	diskd_check_done(target, ERROR);
+	return FALSE;
+}
+
+static void diskd_async_attempt(diskd_target_t *target)
+{
+	diskd_aio_seg_t seg, *segs;
+	gboolean write = (target->type == diskd_probe_write);
+	const char *file = write ? target->wfile : target->path;
+	int flags = write ? (O_WRONLY | O_CREAT | O_DSYNC) : O_RDONLY;
+	gint64 t;
+	int fd, nsegs;
+
+	t = diskd_probe_begin(target);
+	target->verifying = FALSE;
+	if (write && target->write_mode == diskd_write_slots) {
+		fd = diskd_slot_open(target);
+	} else {
+		fd = open(file, flags | O_NONBLOCK | O_DIRECT, 0);
+		if (fd == -1 && write && errno == EINVAL) {
+			/* the file system does not support O_DIRECT */
+			fd = open(file, flags | O_NONBLOCK, 0);
+		}
+	}
+	target->probe_mark = diskd_probe_mark(target, diskd_phase_open, t);
+	if (fd == -1) {
+		target->last_error = errno;
+		crm_err("Could not open %s", file);
+		crm_perror(LOG_ERR, "%s", file);
+		diskd_check_done(target, ERROR);
+		return;
+	}
+
+	if (write) {
+		if (target->write_mode == diskd_write_slots) {
+			diskd_slot_next(target, &seg, TRUE);
+		} else {
+			seg.buf = target->buf;
+			seg.len = pagesize;
+			seg.offset = 0;
+			seg.rw_flags = 0;
+		}
+		segs = &seg;
+		nsegs = 1;
+	} else {
+		/* all samples in one submission */
+		segs = target->segs;
+		nsegs = diskd_sample_plan(target, fd);
+		if (nsegs < 0) {
+			target->last_error = errno;
+			diskd_probe_close(target, fd, NULL, target->probe_mark);
+			diskd_check_done(target, ERROR);
+			return;
+		}
+	}
+	if (diskd_aio_submit(target, fd, write, segs, nsegs, diskd_async_done) < 0) {
+		target->last_error = errno;
+		crm_perror(LOG_ERR, "Could not submit I/O to %s", file);
+		diskd_probe_close(target, fd, diskd_probe_file(target), target->probe_mark);
+		diskd_check_done(target, ERROR);
+		return;
+	}
+	diskd_deadline_arm(target, diskd_async_deadline);
+}
+
+static void diskd_worker_done(diskd_target_t *target, const diskd_worker_result_t *result)
+{
+	int i;
+
+	diskd_deadline_cancel(target);
+	/* the worker timed the phases */
+	for (i = 0; i < DISKD_PHASE_MAX; i++) {
+		if (result->phase[i] >= 0) {
+			diskd_hist_record(&target->hist[i], result->phase[i]);
+		}
+		target->last_phase[i] = result->phase[i];
+	}
+	target->last_error = result->error;
+	target->last_latency = (result->phase[diskd_phase_total] >= 0)
+		? result->phase[diskd_phase_total] : g_get_monotonic_time() - target->probe_start;
+	target->verify_errors += result->verify_errors;
+	diskd_check_done(target, result->status);
+}
+
+static gboolean diskd_worker_deadline(gpointer data)
+{
+	diskd_target_t *target = data;
+
+	target->deadline_id = 0;
+	target->timeouts++;
+	target->timed_out = TRUE;
+	target->last_error = ETIMEDOUT;
+	crm_err("The check of %s did not complete within %d ms", target->path, target->timeout);
+	/* the retry goes to a new worker */
+	diskd_worker_abandon(target);
+	diskd_check_done(target, ERROR);
+	return FALSE;
+}
+
+static void diskd_worker_attempt(diskd_target_t *target)
+{
+	diskd_probe_begin(target);
+	if (diskd_worker_submit(target, diskd_worker_done) < 0) {
+		diskd_check_done(target, ERROR);
+		return;
+	}
+	diskd_deadline_arm(target, diskd_worker_deadline);
+}
+
+static void diskd_check_attempt(diskd_target_t *target)
+{
+	int rc;
+
+	if (io_engine == diskd_io_worker) {
+		diskd_worker_attempt(target);	/* calls diskd_check_done() later */
+		return;
+	}
+	if (io_engine != diskd_io_sync) {
+		diskd_async_attempt(target);	/* calls diskd_check_done() later */
+		return;
+	}
+	diskd_thread_arm(target);
+	rc = diskd_sync_attempt(target);
+	if (diskd_thread_disarm()) {
+		/* late, and reported by the thread. it fails even if the I/O succeeded */
+		target->timeouts++;
+		target->timed_out = TRUE;
+		target->last_error = ETIMEDOUT;
+		rc = ERROR;
+	}
+	diskd_check_done(target, rc);
+}
+
+/* Start a check cycle. The result is reported by check_status(). */
+static void diskd_check_start(diskd_target_t *target)
+{
+	if (target->busy) {
+		/* retrying. the cycle reports when the retries are over */
+		crm_debug("The check of %s is still in progress", target->path);
+		return;
+	}
+	target->voted = FALSE;
+	if (target->io != NULL) {
+		/* The device still has not completed the I/O of an earlier cycle. */
+		crm_warn("I/O on %s is still outstanding", target->path);
+		check_status(target, ERROR);
+		diskd_trace_record(target, diskd_trace_busy, EBUSY);
+		diskd_target_adapt(target, TRUE);
+		return;
+	}
+	if (target->passive && diskd_passive_check(target)) {
+		return;
+	}
+	target->busy = TRUE;
+	target->attempt = 0;
+	target->passive_run = 0;
+	diskd_check_attempt(target);
+}
+
+static void diskd_burst_publish(diskd_target_t *target, gint64 mbps, gint64 iops)
+{
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_lock(&diskd_mutex);
+#else
+		g_mutex_lock(diskd_mutex);
+#endif
+	}
+	if (mbps != target->mbps || iops != target->iops) {
+		target->mbps = mbps;
+		target->iops = iops;
+		g_snprintf(target->mbps_value, sizeof(target->mbps_value), "%lld", (long long)mbps);
+		g_snprintf(target->iops_value, sizeof(target->iops_value), "%lld", (long long)iops);
+		target->burst_sent = FALSE;
+		diskd_attrd_queue(target);
+	}
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_unlock(&diskd_mutex);
+#else
+		g_mutex_unlock(diskd_mutex);
+#endif
+	}
+}
+
+static void diskd_burst_done(diskd_target_t *target, const diskd_burst_result_t *result)
+{
+	gint64 mbps = 0, iops = 0;
+
+	target->bursts++;
+	if (result == NULL || result->error != 0) {
+		target->burst_failures++;
+		crm_warn("Burst on %s failed: %s", target->path,
+			result ? strerror(result->error) : "killed at the deadline");
+	}
+	/* what completed counts even if the burst failed */
+	if (result != NULL && result->elapsed > 0) {
+		mbps = (gint64)(result->bytes / result->elapsed);	/* bytes per usec */
+		iops = (gint64)(result->ios * G_USEC_PER_SEC / result->elapsed);
+		crm_info("Burst on %s: %lld MB/s, %lld IOPS, %llu bytes in %lld usec", target->path,
+			(long long)mbps, (long long)iops, (unsigned long long)result->bytes,
+			(long long)result->elapsed);
+	}
+	diskd_burst_publish(target, mbps, iops);
+}
+
+static gboolean diskd_burst_timer(gpointer data)
+{
+	diskd_target_t *target = data;
+
+	if (target->burst_run != NULL) {
+		/* stuck in I/O since the last one */
+		target->burst_skips++;
+		crm_warn("The last burst on %s is still running", target->path);
+		return TRUE;
+	}
+	if (target->status == ERROR) {
+		/* nothing to measure */
+		target->burst_skips++;
+		diskd_burst_publish(target, 0, 0);
+		return TRUE;
+	}
+	if (diskd_burst_start(target, diskd_burst_done) < 0) {
+		target->burst_failures++;
+	}
+	return TRUE;
+}
+
+/* -o has no main loop, so it simply waits between attempts. */
+static int diskd_oneshot_check(diskd_target_t *target)
+{
+	int i;
+
+	for (i = 0; i <= target->retry; i++) {
+		if (i != 0) {
+			g_usleep((gulong)target->retry_interval * 1000);
+		}
+		if (diskd_sync_attempt(target) == normal) {
+			return normal;
+		}
+	}
+	crm_warn("Error(s) occurred in the check of %s.", target->path);
+	return ERROR;
+}
+
+static void diskd_target_timer(diskd_target_t *target)
+{
+	diskd_check_start(target);
+	if (target->due == 0) {
+		diskd_target_schedule(target);
+	}
+}
+
+static int diskd_target_alloc_buf(diskd_target_t *target)
+{
+	/* aligned for O_DIRECT, the write check uses the first WRITE_DATA bytes */
+	/* the verified write check reads back into the second page */
+	/* a sample takes whole pages, in case the device has 4096 byte blocks */
+	size_t sample = ((size_t)target->block_size + pagesize - 1) / pagesize * pagesize;
+	size_t len = MAX(2 * pagesize, (size_t)target->samples * sample);
+
+	target->ptr = (void *)malloc(len + pagesize);
+	target->segs = calloc(target->samples, sizeof(diskd_aio_seg_t));
+	if (target->ptr == NULL || target->segs == NULL) {
+		return -1;
+	}
+	target->buf = (void *)(((u_long)target->ptr + pagesize) & ~(pagesize-1));
+	target->vbuf = (char *)target->buf + pagesize;
+	target->buf_size = len;
+	memset(target->buf, 0, len);
+	return diskd_aio_prealloc(target);
+}
+
+static diskd_target_t *diskd_target_new(enum diskd_probe_type type, const char *path,
+	const char *attr)
+{
+	diskd_target_t *target = calloc(1, sizeof(diskd_target_t));
+
+	target->type = type;
+	target->path = strdup(path);
+	if (type == diskd_probe_write) {
+		target->wfile = calloc(1, PATH_MAX);
+		g_snprintf(target->wfile, PATH_MAX, "%s/%s", path, WRITE_FILE);
+	}
+	if (attr != NULL) {
+		target->attr = strdup(attr);
+	}
+	target->interval = interval;
+	target->min_interval = min_interval;
+	target->max_interval = max_interval;
+	target->timeout = timeout;
+	target->retry = retry;
+	target->retry_interval = retry_interval;
+	target->phase = -1;
+	target->degraded_ms = degraded_ms;
+	target->degraded_factor = degraded_factor;
+	target->degraded_count = degraded_count;
+	target->fail_n = fail_n;
+	target->fail_m = fail_m;
+	target->recover_n = recover_n;
+	target->recover_m = recover_m;
+	target->samples = samples;
+	target->block_size = (block_size != 0) ? block_size : pagesize;
+	target->sample_mode = sample_mode;
+	target->seed = sample_seed;
+	diskd_sample_reset(target);
+	target->write_mode = write_mode;
+	target->durability = durability;
+	target->slots = slots;
+	target->verify = verify_flag;
+	target->check_paths = paths_flag;
+	target->passive = passive_flag;
+	target->burst = burst_conf;
+	target->mbps = -1;
+	target->iops = -1;
+	target->mbps_first_update = TRUE;
+	target->iops_first_update = TRUE;
+	target->paths_ok = -1;
+	target->paths_sent = -1;
+	target->status = NONE;
+	target->first_update = TRUE;
+	target->paths_first_update = TRUE;
+	return target;
+}
+
+/* A target of one path of a multipath device, checked like the device. */
+static diskd_target_t *diskd_target_new_path(diskd_target_t *parent, const char *dev)
+{
+	char *base = g_path_get_basename(dev);
+	char *attr = g_strdup_printf("%s_path_%s", parent->attr, base);
+	diskd_target_t *target = diskd_target_new(diskd_probe_read, dev, attr);
+
+	g_free(attr);
+	g_free(base);
+	target->parent = parent;
+	target->check_paths = FALSE;
+	target->interval = parent->interval;
+	target->min_interval = parent->min_interval;
+	target->max_interval = parent->max_interval;
+	target->timeout = parent->timeout;
+	target->retry = parent->retry;
+	target->retry_interval = parent->retry_interval;
+	target->degraded_ms = parent->degraded_ms;
+	target->degraded_factor = parent->degraded_factor;
+	target->degraded_count = parent->degraded_count;
+	target->fail_n = parent->fail_n;
+	target->fail_m = parent->fail_m;
+	target->recover_n = parent->recover_n;
+	target->recover_m = parent->recover_m;
+	target->samples = parent->samples;
+	target->block_size = parent->block_size;
+	target->sample_mode = parent->sample_mode;
+	target->seed = parent->seed;
+	diskd_sample_reset(target);
+	target->passive = parent->passive;
+	target->burst.interval = 0;	/* the device is measured as a whole */
+	return target;
+}
+
+static void diskd_target_free(gpointer data)
+{
+	diskd_target_t *target = data;
+
+	diskd_deadline_cancel(target);
+#if GLIB_CHECK_VERSION(2, 36, 0)
+	if (target->deadline != NULL) {
+		g_source_destroy(target->deadline);
+		g_source_unref(target->deadline);
+	}
+#endif
+	if (target->retry_id != 0) {
+		g_source_remove(target->retry_id);
+	}
+	if (target->burst_id != 0) {
+		g_source_remove(target->burst_id);
+	}
+	diskd_burst_stop(target);
+	diskd_aio_orphan(target);
+	free(target->ptr);
+	free(target->segs);
+	free(target->ioerr_path);
+	free(target->stat_path);
+	g_list_free(target->paths);
+	g_free(target->paths_attr);
+	g_free(target->mbps_attr);
+	g_free(target->iops_attr);
+	g_free(target->spec);
+	free(target->path);
+	free(target->wfile);
+	free(target->attr);
+	free(target);
+}
+
+static int diskd_parse_range(const char *value, int min, int max, int *result)
+{
+	int i = crm_parse_int(value, "-1");
+
+	if ((i == 0) && (strcmp(value, "0") != 0)) {
+		return -1;
+	}
+	if ((i < min) || (i > max)) {
+		return -1;
+	}
+	*result = i;
+	return 0;
+}
+
+/* A time in seconds, or in milliseconds with the "ms" suffix. */
+static int diskd_parse_msec(const char *value, int min, int max, int *result)
+{
+	char *end = NULL;
+	gint64 ms = g_ascii_strtoll(value, &end, 10);
+
+	if (end == value) {
+		return -1;
+	}
+	if (strcmp(end, "ms") == 0) {
+		/* as is */
+	} else if (*end == '\0' || strcmp(end, "s") == 0) {
+		ms *= 1000;
+	} else {
+		return -1;
+	}
+	if ((ms < min) || (ms > max)) {
+		return -1;
+	}
+	*result = (int)ms;
+	return 0;
+}
+
+/* <n>/<m> of a voting window, 1 <= n <= m <= DISKD_VOTE_MAX */
+static int diskd_parse_window(const char *value, int *n, int *m)
+{
+	int i, j;
+	char c;
+
+	if (sscanf(value, "%d/%d%c", &i, &j, &c) != 2) {
+		return -1;
+	}
+	if (i < 1 || i > j || j > DISKD_VOTE_MAX) {
+		return -1;
+	}
+	*n = i;
+	*m = j;
+	return 0;
+}
+
+/*
+ * A key of the burst (-G, or a target key with the burst- prefix).
+ * Returns 1 if the key is not one of them.
+ */
+static int diskd_parse_burst(diskd_burst_conf_t *conf, const char *key, const char *value)
+{
+	if (strcmp(key, "interval") == 0) {
+		if (strcmp(value, "0") == 0) {
+			conf->interval = 0;
+			return 0;
+		}
+		return diskd_parse_msec(value, MIN_BURST_INTERVAL, MAX_BURST_INTERVAL, &conf->interval);
+	} else if (strcmp(key, "depth") == 0) {
+		return diskd_parse_range(value, MIN_BURST_DEPTH, MAX_BURST_DEPTH, &conf->depth);
+	} else if (strcmp(key, "block-size") == 0) {
+		return diskd_parse_range(value, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, &conf->block_size);
+	} else if (strcmp(key, "read") == 0) {
+		return diskd_parse_range(value, 0, 100, &conf->read_pct);
+	} else if (strcmp(key, "duration") == 0) {
+		return diskd_parse_msec(value, MIN_BURST_DURATION, MAX_BURST_DURATION, &conf->duration);
+	} else if (strcmp(key, "max-mb") == 0) {
+		return diskd_parse_range(value, MIN_BURST_MB, MAX_BURST_MB, &conf->max_mb);
+	}
+	return 1;
+}
+
+/* -G <key>=<value>,... */
+static int diskd_parse_burst_spec(const char *spec)
+{
+	gchar **items = g_strsplit(spec, ",", 0);
+	int i, rc = 0;
+
+	for (i = 0; items[i] != NULL && rc == 0; i++) {
+		char *value = strchr(items[i], '=');
+
+		if (value == NULL) {
+			rc = -1;
+			break;
+		}
+		*value++ = '\0';
+		rc = diskd_parse_burst(&burst_conf, items[i], value);
+	}
+	if (rc != 0) {
+		crm_err("Invalid burst: %s", spec);
+	}
+	g_strfreev(items);
+	return (rc == 0) ? 0 : -1;
+}
+
+/* 0 (off), or a factor above 1 */
+static int diskd_parse_factor(const char *value, double *result)
+{
+	char *end = NULL;
+	double d = strtod(value, &end);
+
+	if (end == value || *end != '\0') {
+		return -1;
+	}
+	if (d != 0 && (d <= 1.0 || d > MAX_DEGRADED_FACTOR)) {
+		return -1;
+	}
+	*result = d;
+	return 0;
+}
+
+static int diskd_parse_seed(const char *value, guint64 *result)
+{
+	char *end = NULL;
+	guint64 seed = g_ascii_strtoull(value, &end, 0);
+
+	if (end == value || *end != '\0') {
+		return -1;
+	}
+	*result = seed;
+	return 0;
+}
+
+/*
+ * Parse a target specification of the -T option.
+ *   <read|write>:<path>[,attr=<name>][,interval=<s>][,timeout=<s>][,retry=<n>][,retry-interval=<s>]
+ */
+static diskd_target_t *diskd_target_parse(const char *spec)
+{
+	diskd_target_t *target = NULL;
+	enum diskd_probe_type type;
+	const char *path;
+	gchar **items;
+	int i, rc = 0;
+
+	if (strncmp(spec, "read:", 5) == 0) {
+		type = diskd_probe_read;
+		path = spec + 5;
+	} else if (strncmp(spec, "write:", 6) == 0) {
+		type = diskd_probe_write;
+		path = spec + 6;
+	} else {
+		crm_err("Unknown target type: %s", spec);
+		return NULL;
+	}
+
+	items = g_strsplit(path, ",", 0);
+	if (items[0] == NULL || items[0][0] == '\0') {
+		crm_err("No path in target: %s", spec);
+		g_strfreev(items);
+		return NULL;
+	}
+	target = diskd_target_new(type, items[0], NULL);
+
+	for (i = 1; items[i] != NULL && rc == 0; i++) {
+		char *key = items[i];
+		char *value = strchr(key, '=');
+
+		if (value == NULL) {
+			rc = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp(key, "attr") == 0 && value[0] != '\0') {
+			free(target->attr);
+			target->attr = strdup(value);
+		} else if (strcmp(key, "interval") == 0) {
+			rc = diskd_parse_msec(value, MIN_INTERVAL, MAX_INTERVAL, &target->interval);
+		} else if (strcmp(key, "min-interval") == 0) {
+			rc = diskd_parse_msec(value, MIN_INTERVAL, MAX_INTERVAL, &target->min_interval);
+		} else if (strcmp(key, "max-interval") == 0) {
+			rc = diskd_parse_msec(value, MIN_INTERVAL, MAX_INTERVAL, &target->max_interval);
+		} else if (strcmp(key, "phase") == 0) {
+			rc = diskd_parse_msec(value, 0, MAX_INTERVAL, &target->phase);
+		} else if (strcmp(key, "timeout") == 0) {
+			rc = diskd_parse_msec(value, MIN_TIMEOUT, MAX_TIMEOUT, &target->timeout);
+		} else if (strcmp(key, "retry") == 0) {
+			rc = diskd_parse_range(value, MIN_RETRY, MAX_RETRY, &target->retry);
+		} else if (strcmp(key, "retry-interval") == 0) {
+			rc = diskd_parse_msec(value, MIN_RETRY_INTERVAL, MAX_RETRY_INTERVAL,
+				&target->retry_interval);
+		} else if (strcmp(key, "degraded-latency") == 0) {
+			rc = diskd_parse_range(value, MIN_DEGRADED_MS, MAX_DEGRADED_MS,
+				&target->degraded_ms);
+		} else if (strcmp(key, "degraded-factor") == 0) {
+			rc = diskd_parse_factor(value, &target->degraded_factor);
+		} else if (strcmp(key, "degraded-count") == 0) {
+			rc = diskd_parse_range(value, MIN_DEGRADED_COUNT, MAX_DEGRADED_COUNT,
+				&target->degraded_count);
+		} else if (strcmp(key, "fail-window") == 0) {
+			rc = diskd_parse_window(value, &target->fail_n, &target->fail_m);
+		} else if (strcmp(key, "recover-window") == 0) {
+			rc = diskd_parse_window(value, &target->recover_n, &target->recover_m);
+		} else if (strncmp(key, "burst-", 6) == 0) {
+			rc = diskd_parse_burst(&target->burst, key + 6, value);
+		} else if (strcmp(key, "samples") == 0) {
+			rc = diskd_parse_range(value, MIN_SAMPLES, MAX_SAMPLES, &target->samples);
+		} else if (strcmp(key, "block-size") == 0) {
+			rc = diskd_parse_range(value, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, &target->block_size);
+		} else if (strcmp(key, "sample") == 0) {
+			int mode = diskd_sample_parse_mode(value);
+
+			if (mode < 0) {
+				rc = -1;
+			} else {
+				target->sample_mode = mode;
+			}
+		} else if (strcmp(key, "write-mode") == 0) {
+			int mode = diskd_slot_parse_mode(value);
+
+			if (mode < 0) {
+				rc = -1;
+			} else {
+				target->write_mode = mode;
+			}
+		} else if (strcmp(key, "durability") == 0) {
+			int mode = diskd_slot_parse_durability(value);
+
+			if (mode < 0) {
+				rc = -1;
+			} else {
+				target->durability = mode;
+			}
+		} else if (strcmp(key, "verify") == 0) {
+			rc = crm_str_to_boolean(value, &target->verify) < 0 ? -1 : 0;
+		} else if (strcmp(key, "paths") == 0) {
+			rc = crm_str_to_boolean(value, &target->check_paths) < 0 ? -1 : 0;
+		} else if (strcmp(key, "passive") == 0) {
+			rc = crm_str_to_boolean(value, &target->passive) < 0 ? -1 : 0;
+		} else if (strcmp(key, "slots") == 0) {
+			rc = diskd_parse_range(value, MIN_SLOTS, MAX_SLOTS, &target->slots);
+		} else if (strcmp(key, "seed") == 0) {
+			rc = diskd_parse_seed(value, &target->seed);
+			diskd_sample_reset(target);
+		} else {
+			rc = -1;
+		}
+	}
+	if (rc != 0) {
+		crm_err("Invalid option \"%s\" in target: %s", items[i - 1], spec);
+		g_strfreev(items);
+		diskd_target_free(target);
+		return NULL;
+	}
+	g_strfreev(items);
+
+	if (target->attr == NULL) {
+		char *base = g_path_get_basename(target->path);
+
+		target->attr = g_strdup_printf("%s_%s", diskd_attr, base);
+		g_free(base);
+	}
+	target->spec = g_strdup(spec);
+	return target;
+}
+
+static int diskd_targets_parse(GList **list, GList *specs)
+{
+	GList *gIter;
+
+	for (gIter = specs; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = diskd_target_parse(gIter->data);
+
+		if (target == NULL) {
+			return -1;
+		}
+		*list = g_list_append(*list, target);
+	}
+	return 0;
+}
+
+/* Add the targets of -N/-w/-d, of -T options and of the config file to list. */
+static int diskd_targets_init(GList **list, GList *config_specs)
+{
+	GList *gIter, *gIter2;
+	diskd_target_t *first = NULL;
+	int i, n;
+
+	if (device != NULL) {
+		first = diskd_target_new(diskd_probe_read, device, diskd_attr);
+	} else if (wflag) {
+		first = diskd_target_new(diskd_probe_write, (wdir != NULL)? wdir : WRITE_DIR, diskd_attr);
+	}
+	if (first != NULL) {
+		first->spec = g_strdup_printf("%s:%s", (first->type == diskd_probe_read)? "read" : "write",
+			first->path);
+		*list = g_list_append(*list, first);
+	}
+
+	if (diskd_targets_parse(list, target_specs) < 0
+	    || diskd_targets_parse(list, config_specs) < 0) {
+		return -1;
+	}
+
+	/* the paths are added after the devices, as targets of their own */
+	for (gIter = *list; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+		GList *devs;
+
+		if (!target->check_paths || target->parent != NULL) {
+			continue;
+		}
+		if (target->type != diskd_probe_read) {
+			crm_err("paths of %s needs a read target", target->path);
+			return -1;
+		}
+		devs = diskd_paths_discover(target);
+		if (devs == NULL) {
+			return -1;
+		}
+		for (gIter2 = devs; gIter2 != NULL; gIter2 = gIter2->next) {
+			diskd_target_t *path = diskd_target_new_path(target, gIter2->data);
+
+			target->paths = g_list_append(target->paths, path);
+			*list = g_list_append(*list, path);
+		}
+		target->paths_attr = g_strdup_printf("%s_paths_ok", target->attr);
+		crm_info("Checking %d paths of %s", g_list_length(devs), target->path);
+		g_list_free_full(devs, g_free);
+	}
+
+	for (gIter = *list; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		/* a bound that is not given is the interval */
+		if (target->min_interval == 0) {
+			target->min_interval = MIN(target->interval,
+				target->max_interval ? target->max_interval : target->interval);
+		}
+		if (target->max_interval == 0) {
+			target->max_interval = MAX(target->interval, target->min_interval);
+		}
+		if (target->min_interval > target->max_interval) {
+			crm_err("min-interval of %s is longer than max-interval", target->path);
+			return -1;
+		}
+		target->cur_interval = CLAMP(target->interval, target->min_interval,
+			target->max_interval);
+		if (target->verify
+		    && (target->type != diskd_probe_write || target->write_mode != diskd_write_slots)) {
+			crm_err("Verify of %s needs a write target with the slots write mode", target->path);
+			return -1;
+		}
+		if (io_engine == diskd_io_sync && !oneshot_flag
+		    && target->samples > MAX_SYNC_SAMPLES) {
+			/* each sample would add a read to the time the main loop is blocked */
+			crm_warn("The sync engine reads %d samples of %s, not %d. Use -E aio or uring"
+				" for more", MAX_SYNC_SAMPLES, target->path, target->samples);
+			target->samples = MAX_SYNC_SAMPLES;
+		}
+		if (target->block_size % MIN_BLOCK_SIZE != 0
+		    || (gint64)target->samples * target->block_size > MAX_SAMPLE_BYTES) {
+			crm_err("Invalid block size %d for %d samples of %s", target->block_size,
+				target->samples, target->path);
+			return -1;
+		}
+		if (target->burst.interval > 0) {
+			if (target->burst.block_size % MIN_BLOCK_SIZE != 0
+			    || target->burst.interval < target->burst.duration * BURST_DUTY) {
+				crm_err("Invalid burst of %s: the block size must be a multiple of %d,"
+					" and the interval %d times the duration", target->path,
+					MIN_BLOCK_SIZE, BURST_DUTY);
+				return -1;
+			}
+			if (target->type == diskd_probe_read && target->burst.read_pct != 100) {
+				/* never write to a shared device */
+				crm_warn("Burst on %s only reads, it is a read target", target->path);
+				target->burst.read_pct = 100;
+			}
+			target->mbps_attr = g_strdup_printf("%s_mbps", target->attr);
+			target->iops_attr = g_strdup_printf("%s_iops", target->attr);
+		}
+		for (gIter2 = gIter->next; gIter2 != NULL; gIter2 = gIter2->next) {
+			diskd_target_t *other = gIter2->data;
+
+			if (strcmp(target->attr, other->attr) == 0) {
+				crm_err("Attribute name %s is used by two targets", target->attr);
+				return -1;
+			}
+			if (target->type == other->type && strcmp(target->path, other->path) == 0) {
+				crm_err("Target %s is specified twice", target->path);
+				return -1;
+			}
+		}
+	}
+
+	/* Spread the first checks over the interval, so that they do not bunch.
+	 * The paths of a device are checked together with it. */
+	n = 0;
+	for (gIter = *list; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (target->parent == NULL) {
+			n++;
+		}
+	}
+	i = 0;
+	for (gIter = *list; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (target->parent != NULL) {
+			continue;
+		}
+		if (target->phase < 0) {
+			target->phase = (int)((gint64)i * target->cur_interval / n);
+		}
+		for (gIter2 = target->paths; gIter2 != NULL; gIter2 = gIter2->next) {
+			diskd_target_t *path = gIter2->data;
+
+			path->phase = target->phase;
+		}
+		i++;
+	}
+	return 0;
+}
+
+/*
+ * Build the targets from the options and the config file.  Nothing is
+ * left behind if it fails, so that a reload can keep the running ones.
+ */
+static int diskd_targets_build(GList **result)
+{
+	GList *list = NULL, *config_specs = NULL;
+	int rc;
+
+	if (config_file != NULL && diskd_config_read(config_file, &config_specs) < 0) {
+		return -1;
+	}
+	rc = diskd_targets_init(&list, config_specs);
+	g_list_free_full(config_specs, g_free);
+	if (rc == 0 && list == NULL) {
+		crm_err("No target to monitor");
+		rc = -1;
+	}
+	if (rc < 0) {
+		g_list_free_full(list, diskd_target_free);
+		return -1;
+	}
+	*result = list;
+	return 0;
+}
+
+/* Start the checks of target, the first due at due, and its bursts. */
+static void diskd_target_start(diskd_target_t *target, gint64 due)
+{
+	if (target->result_time == 0) {
+		target->result_time = g_get_monotonic_time();
+	}
+	diskd_sched_add(target, due);
+	if (target->burst.interval > 0) {
+		target->burst_id = g_timeout_add(target->burst.interval, diskd_burst_timer, target);
+	}
+}
+
+/*
+ * Stop target and free it. Its outstanding I/O and processes are left to end.
+ * The timer thread may be reporting it; the free waits for that under the lock.
+ */
+static void diskd_target_remove(diskd_target_t *target)
+{
+	diskd_sched_remove(target);
+	diskd_worker_stop(target);
+	diskd_thread_release(target);
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_lock(&diskd_mutex);
+#else
+		g_mutex_lock(diskd_mutex);
+#endif
+	}
+	diskd_target_free(target);
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_unlock(&diskd_mutex);
+#else
+		g_mutex_unlock(diskd_mutex);
+#endif
+	}
+}
+
+static diskd_target_t *diskd_target_find(GList *list, const char *attr)
+{
+	GList *gIter;
+
+	for (gIter = list; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (strcmp(target->attr, attr) == 0) {
+			return target;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * target replaces old, a target of the same attribute with other
+ * options.  It takes over the value attrd has and the statistics, so
+ * that neither the attribute nor the counters start over.
+ */
+static void diskd_target_adopt(diskd_target_t *target, diskd_target_t *old)
+{
+	target->status = old->status;
+	target->value = old->value;
+	target->result_time = old->result_time;
+	target->first_update = old->first_update;
+	target->sent_value = old->sent_value;
+	target->sent_time = old->sent_time;
+	target->votes = old->votes;
+	target->vote_count = old->vote_count;
+	target->fail_since = old->fail_since;
+	target->last_latency = old->last_latency;
+	memcpy(target->last_phase, old->last_phase, sizeof(target->last_phase));
+	target->last_error = old->last_error;
+
+	target->probes = old->probes;
+	target->probes_ok = old->probes_ok;
+	target->timeouts = old->timeouts;
+	target->verify_errors = old->verify_errors;
+	target->passive_skips = old->passive_skips;
+	target->stalls = old->stalls;
+	target->error_events = old->error_events;
+	target->recoveries = old->recoveries;
+	memcpy(target->hist, old->hist, sizeof(target->hist));
+	target->detect = old->detect;
+	target->jitter = old->jitter;
+
+	/* the latency of another device says nothing about this one */
+	if (target->type == old->type && strcmp(target->path, old->path) == 0) {
+		target->is_degraded = old->is_degraded;
+		target->slow_count = old->slow_count;
+		target->fast_count = old->fast_count;
+		target->baseline = old->baseline;
+		target->baseline_samples = old->baseline_samples;
+	}
+
+	if (target->paths_attr != NULL && old->paths_attr != NULL) {
+		target->paths_ok = old->paths_ok;
+		memcpy(target->paths_value, old->paths_value, sizeof(target->paths_value));
+		target->paths_sent = old->paths_sent;
+		target->paths_first_update = old->paths_first_update;
+	} else if (old->paths_attr != NULL) {
+		diskd_attrd_delete(old->paths_attr);
+	}
+
+	target->bursts = old->bursts;
+	target->burst_failures = old->burst_failures;
+	target->burst_skips = old->burst_skips;
+	if (target->mbps_attr != NULL && old->mbps_attr != NULL) {
+		target->mbps = old->mbps;
+		target->iops = old->iops;
+		memcpy(target->mbps_value, old->mbps_value, sizeof(target->mbps_value));
+		memcpy(target->iops_value, old->iops_value, sizeof(target->iops_value));
+		target->burst_sent = old->burst_sent;
+		target->mbps_first_update = old->mbps_first_update;
+		target->iops_first_update = old->iops_first_update;
+	} else if (old->mbps_attr != NULL) {
+		diskd_attrd_delete(old->mbps_attr);
+		diskd_attrd_delete(old->iops_attr);
+	}
+}
+
+static void diskd_reload_signal(int nsig)
+{
+	diskd_reload(NULL);
+}
+
+/*
+ * Read the config file again and apply what changed.  A target whose
+ * specification is the same is kept as it is, with its timers, worker
+ * and attribute.  A changed one is replaced by one that takes over its
+ * state (diskd_target_adopt) and is checked at its next due time.  A
+ * removed one is stopped and its attributes are deleted.  Nothing is
+ * changed if the file has an error.  A summary is added to out.
+ */
+int diskd_reload(GString *out)
+{
+	GList *built = NULL, *next = NULL, *retired = NULL, *gIter, *gIter2;
+	gint64 now = g_get_monotonic_time();
+	int added = 0, changed = 0, removed = 0, kept = 0;
+
+	if (config_file == NULL) {
+		crm_warn("Nothing to reload, no config file was given");
+		return -1;
+	}
+	crm_info("Reloading %s", config_file);
+	if (diskd_targets_build(&built) < 0) {
+		crm_err("Keeping the running targets, %s has errors", config_file);
+		return -1;
+	}
+
+	/* allocate everything before a target is replaced */
+	for (gIter = built; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+		diskd_target_t *old = diskd_target_find(targets,
+			target->parent ? target->parent->attr : target->attr);
+
+		if (old != NULL && strcmp(old->spec, target->parent ? target->parent->spec
+			: target->spec) == 0) {
+			continue;
+		}
+		if (diskd_target_alloc_buf(target) < 0) {
+			crm_err("Could not allocate memory, keeping the running targets");
+			g_list_free_full(built, diskd_target_free);
+			return -1;
+		}
+	}
+
+	for (gIter = built; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+		diskd_target_t *old;
+
+		if (target->parent != NULL) {
+			continue;	/* goes with its device */
+		}
+		old = diskd_target_find(targets, target->attr);
+		if (old != NULL && strcmp(old->spec, target->spec) == 0) {
+			next = g_list_append(next, old);
+			for (gIter2 = old->paths; gIter2 != NULL; gIter2 = gIter2->next) {
+				next = g_list_append(next, gIter2->data);
+			}
+			retired = g_list_append(retired, target);
+			kept++;
+			continue;
+		}
+
+		if (old != NULL) {
+			crm_info("Target %s is changed: %s", target->attr, target->spec);
+			diskd_target_adopt(target, old);
+			for (gIter2 = target->paths; gIter2 != NULL; gIter2 = gIter2->next) {
+				diskd_target_t *path = gIter2->data;
+				diskd_target_t *old_path = diskd_target_find(old->paths, path->attr);
+
+				if (old_path != NULL) {
+					diskd_target_adopt(path, old_path);
+				}
+			}
+			/* an attempt in progress is lost, so check it again at once */
+			if (old->busy || old->due == 0) {
+				target->phase = 0;
+			} else {
+				target->phase = (int)(MIN(old->due - now,
+					(gint64)target->cur_interval * 1000) / 1000);
+			}
+			retired = g_list_append(retired, old);
+			changed++;
+		} else {
+			crm_info("Target %s is added: %s", target->attr, target->spec);
+			added++;
+		}
+		next = g_list_append(next, target);
+		for (gIter2 = target->paths; gIter2 != NULL; gIter2 = gIter2->next) {
+			diskd_target_t *path = gIter2->data;
+
+			path->phase = target->phase;
+			next = g_list_append(next, path);
+		}
+	}
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *old = gIter->data;
+
+		if (old->parent != NULL || g_list_find(next, old) != NULL
+		    || g_list_find(retired, old) != NULL) {
+			continue;
+		}
+		crm_info("Target %s is removed", old->attr);
+		diskd_attrd_delete(old->attr);
+		if (old->paths_attr != NULL) {
+			diskd_attrd_delete(old->paths_attr);
+		}
+		if (old->mbps_attr != NULL) {
+			diskd_attrd_delete(old->mbps_attr);
+			diskd_attrd_delete(old->iops_attr);
+		}
+		retired = g_list_append(retired, old);
+		removed++;
+	}
+
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_lock(&diskd_mutex);
+#else
+		g_mutex_lock(diskd_mutex);
+#endif
+	}
+	g_list_free(targets);
+	targets = next;
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_unlock(&diskd_mutex);
+#else
+		g_mutex_unlock(diskd_mutex);
+#endif
+	}
+
+	for (gIter = built; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (g_list_find(targets, target) == NULL) {
+			continue;	/* the running one is kept */
+		}
+		if (io_engine == diskd_io_worker) {
+			diskd_worker_spawn(target);
+		}
+		diskd_target_start(target, now + (gint64)target->phase * 1000);
+	}
+	g_list_free(built);
+
+	/* the retired devices go with their paths */
+	for (gIter = retired; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		for (gIter2 = target->paths; gIter2 != NULL; gIter2 = gIter2->next) {
+			diskd_target_remove(gIter2->data);
+		}
+		diskd_target_remove(target);
+	}
+	g_list_free(retired);
+
+	crm_info("Reloaded %s: %d targets added, %d changed, %d removed, %d kept",
+		config_file, added, changed, removed, kept);
+	if (out != NULL) {
+		g_string_append_printf(out, "reload added=%d changed=%d removed=%d kept=%d\n",
+			added, changed, removed, kept);
+	}
+	return 0;
+}
+
+/* a target checked by a child process of -o */
+typedef struct diskd_oneshot_s {
+	diskd_target_t *target;
+	pid_t pid;
+	int fd;			/* result pipe. -1 once the result is in */
+	int status;		/* ERROR or normal */
+	gint64 latency;		/* usec */
+	const char *reason;	/* why the result is ERROR. NULL if checked */
+} diskd_oneshot_t;
+
+/* what a child writes to its result pipe */
+typedef struct diskd_oneshot_result_s {
+	int status;
+	gint64 latency;
+} diskd_oneshot_result_t;
+
+static void diskd_oneshot_child(diskd_target_t *target, int fd)
+{
+	diskd_oneshot_result_t result;
+	gint64 start = g_get_monotonic_time();
+
+	if (diskd_target_alloc_buf(target) < 0) {
+		crm_err("Could not allocate memory");
+		result.status = ERROR;
+	} else {
+		result.status = diskd_oneshot_check(target);
+	}
+	result.latency = g_get_monotonic_time() - start;
+	if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+		_exit(1);
+	}
+	_exit(0);
+}
+
+static int diskd_oneshot_spawn(diskd_oneshot_t *os)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0) {
+		crm_perror(LOG_ERR, "pipe() failed");
+		return -1;
+	}
+	os->pid = fork();
+	if (os->pid < 0) {
+		crm_perror(LOG_ERR, "Could not fork the check of %s", os->target->path);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (os->pid == 0) {
+		close(fds[0]);
+		diskd_oneshot_child(os->target, fds[1]);
+	}
+	close(fds[1]);
+	os->fd = fds[0];
+	return 0;
+}
+
+static void diskd_oneshot_read(diskd_oneshot_t *os)
+{
+	diskd_oneshot_result_t result;
+	ssize_t rc;
+
+	do {
+		rc = read(os->fd, &result, sizeof(result));
+	} while (rc < 0 && errno == EINTR);
+	if (rc == sizeof(result)) {
+		os->status = result.status;
+		os->latency = result.latency;
+		os->reason = NULL;
+	} else {
+		crm_err("The check of %s ended without a result", os->target->path);
+		os->reason = "no result";
+	}
+	close(os->fd);
+	os->fd = -1;
+}
+
+/* Longest time the checks can take: every attempt times out. sec. */
+static int diskd_oneshot_worst_case(void)
+{
+	GList *gIter;
+	int worst = 0;
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+		int t = (target->retry + 1) * target->timeout
+			+ target->retry * target->retry_interval;
+
+		worst = MAX(worst, t);
+	}
+	return worst / 1000 + 1;
+}
+
+/*
+ * Check all targets at once, each in a child process, and wait for them
+ * until the deadline.  A child stuck in the I/O of a hung device is
+ * killed (or left behind in D state) and its target reported as ERROR,
+ * so -o always returns in time.
+ */
+static int oneshot(void)
+{
+	int n = g_list_length(targets);
+	diskd_oneshot_t *os = calloc(n, sizeof(diskd_oneshot_t));
+	struct pollfd *pfds = calloc(n, sizeof(struct pollfd));
+	int deadline_s = oneshot_deadline ? oneshot_deadline : diskd_oneshot_worst_case();
+	gint64 deadline = g_get_monotonic_time() + (gint64)deadline_s * G_USEC_PER_SEC;
+	GList *gIter;
+	int i, pending = 0, rc = 0;
+
+	if (os == NULL || pfds == NULL) {
+		crm_err("Could not allocate memory");
+		crm_exit(1);
+	}
+	for (i = 0, gIter = targets; gIter != NULL; i++, gIter = gIter->next) {
+		os[i].target = gIter->data;
+		os[i].status = ERROR;
+		os[i].fd = -1;
+		os[i].reason = "not checked";
+		if (diskd_oneshot_spawn(&os[i]) == 0) {
+			pending++;
+		}
+	}
+	crm_debug("Checking %d target(s), deadline %d sec.", n, deadline_s);
+
+	while (pending > 0) {
+		gint64 now = g_get_monotonic_time();
+		int nfds = 0, ready;
+
+		if (now >= deadline) {
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (os[i].fd != -1) {
+				pfds[nfds].fd = os[i].fd;
+				pfds[nfds].events = POLLIN;
+				pfds[nfds].revents = 0;
+				nfds++;
+			}
+		}
+		ready = poll(pfds, nfds, (int)((deadline - now + 999) / 1000));
+		if (ready < 0 && errno != EINTR) {
+			crm_perror(LOG_ERR, "poll() failed");
+			break;
+		}
+		for (i = 0; ready > 0 && i < n; i++) {
+			int j;
+
+			if (os[i].fd == -1) {
+				continue;
+			}
+			for (j = 0; j < nfds && pfds[j].fd != os[i].fd; j++);
+			if (j < nfds && pfds[j].revents != 0) {
+				diskd_oneshot_read(&os[i]);
+				pending--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		diskd_target_t *target = os[i].target;
+
+		if (os[i].fd != -1) {
+			crm_err("The check of %s did not finish within %d sec.", target->path, deadline_s);
+			os[i].reason = "deadline";
+			close(os[i].fd);
+			kill(os[i].pid, SIGKILL);
+		}
+		if (os[i].pid > 0) {
+			/* a child in D state cannot be reaped; it is left to init */
+			waitpid(os[i].pid, NULL, WNOHANG);
+		}
+		if (os[i].reason != NULL) {
+			os[i].status = ERROR;
+		}
+		/* a failed path is only counted, its device decides */
+		if (os[i].status == ERROR && target->parent == NULL) {
+			rc = ERROR;
+		}
+		target->status = os[i].status;
+	}
+	for (i = 0; i < n; i++) {
+		diskd_target_t *target = os[i].target;
+
+		diskd_paths_update(target);
+		printf("target %s path=%s value=%s time=%lld%s%s", target->attr, target->path,
+			(os[i].status == ERROR) ? "ERROR" : "normal",
+			(long long)(os[i].latency / 1000),
+			(os[i].reason != NULL) ? " reason=" : "",
+			(os[i].reason != NULL) ? os[i].reason : "");
+		if (target->paths_ok >= 0) {
+			printf(" paths_ok=%s", target->paths_value);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+
+	free(pfds);
+	free(os);
+	g_list_free_full(targets, diskd_target_free);
+	targets = NULL;
+
+	return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+	int argerr = 0;
+	int flag;
+	char *pid_file = NULL;
+	char *ctl_socket = NULL;
+	char *query_cmd = NULL;
+	char *trace_file = NULL;
+	int trace_records = 16384;
+	GList *gIter;
+	gint64 start;
+	gboolean daemonize = FALSE;
+
+#ifdef HAVE_GETOPT_H
+	int option_index = 0;
+	static struct option long_options[] = {
+		/* Top-level Options */
+		{"verbose", 0, 0, 'V'},
+		{"help", 0, 0, '?'},
+		{"pid-file", 1, 0, 'p'},
+		{"attr-name", 1, 0, 'a'},
+		{"read-device-name", 1, 0, 'N'},
+		{"daemonize", 0, 0, 'D'},
+		{"interval", 1, 0, 'i'},
+		{"retry", 1, 0, 'r'},
+		{"retry-interval", 1, 0, 'I'},
+		{"check-timeout", 1, 0, 't'},
+		{"write-check", 0, 0, 'w'},		/* add option 2008.10.24 */
+		{"write-directory-name", 1, 0, 'd'},	/* add option 2009.4.17 */
+		{"oneshot", 0, 0, 'o'},			/* add option 2009.10.01 */
+		{"exec-thread", 0, 0, 'e'},		/* add option 2011.09.30 */
+		{"dampen", 1, 0, 'm'},
+		{"refresh", 1, 0, 'R'},
+		{"coalesce", 1, 0, 'C'},
+		{"degraded-latency", 1, 0, 'L'},
+		{"degraded-factor", 1, 0, 'F'},
+		{"degraded-count", 1, 0, 'K'},
+		{"fail-window", 1, 0, 'f'},
+		{"recover-window", 1, 0, 'g'},
+		{"samples", 1, 0, 'n'},
+		{"block-size", 1, 0, 'b'},
+		{"sample-mode", 1, 0, 'M'},
+		{"seed", 1, 0, 's'},
+		{"write-mode", 1, 0, 'W'},
+		{"durability", 1, 0, 'Y'},
+		{"slots", 1, 0, 'Z'},
+		{"verify", 0, 0, 'X'},
+		{"paths", 0, 0, 'P'},
+		{"passive", 0, 0, 'A'},
+		{"burst", 1, 0, 'G'},
+		{"min-interval", 1, 0, 'j'},
+		{"max-interval", 1, 0, 'J'},
+		{"ctl-socket", 1, 0, 'S'},
+		{"query", 1, 0, 'Q'},
+		{"target", 1, 0, 'T'},
+		{"config", 1, 0, 'U'},
+		{"io-engine", 1, 0, 'E'},
+		{"max-stuck", 1, 0, 'u'},
+		{"realtime", 0, 0, 'x'},
+		{"trace", 1, 0, 'B'},
+		{"trace-records", 1, 0, 'c'},
+		{"rt-priority", 1, 0, 'y'},
+		{"deadline", 1, 0, 'O'},
+
+		{0, 0, 0, 0}
+	};
+#endif
+	pid_file = strdup(PID_FILE);
+	crm_system_name = strdup(basename(argv[0]));
+
+	mainloop_add_signal(SIGTERM, diskd_shutdown);
+	mainloop_add_signal(SIGHUP, diskd_reload_signal);
 
 	crm_log_init(basename(argv[0]), LOG_INFO, TRUE, FALSE, argc, argv, FALSE);
 
@@ -668,18 +2813,15 @@ main(int argc, char **argv)
 					++argerr;
 				break;
 			case 'I':
-				retry_interval = crm_parse_int(optarg, "1");
-				if ((retry_interval < MIN_RETRY_INTERVAL) || (retry_interval > MAX_RETRY_INTERVAL))
+				if (diskd_parse_msec(optarg, MIN_RETRY_INTERVAL, MAX_RETRY_INTERVAL, &retry_interval) < 0)
 					++argerr;
 				break;
 			case 'i':
-				interval = crm_parse_int(optarg, "1");
-				if ((interval < MIN_INTERVAL) || (interval > MAX_INTERVAL))
+				if (diskd_parse_msec(optarg, MIN_INTERVAL, MAX_INTERVAL, &interval) < 0)
 					++argerr;
 				break;
 			case 't':
-				timeout = crm_parse_int(optarg, "1");
-				if ((timeout < MIN_TIMEOUT) || (timeout > MAX_TIMEOUT))
+				if (diskd_parse_msec(optarg, MIN_TIMEOUT, MAX_TIMEOUT, &timeout) < 0)
 					++argerr;
 				break;
 			case 'N':
@@ -704,12 +2846,135 @@ main(int argc, char **argv)
 			case 'e':   /* add option 2011.09.30 */
 				exec_thread_flag =1;
 				break;
+			case 'T':
+				target_specs = g_list_append(target_specs, strdup(optarg));
+				break;
+			case 'U':
+				/* read again after the daemon changed its directory */
+				if (optarg[0] == '/') {
+					config_file = g_strdup(optarg);
+				} else {
+					char *cwd = getcwd(NULL, 0);
+
+					config_file = g_strdup_printf("%s/%s", cwd ? cwd : "", optarg);
+					free(cwd);
+				}
+				break;
+			case 'E':
+				if (diskd_aio_parse_engine(optarg) < 0)
+					++argerr;
+				break;
 			case 'm':
 				if (0 > crm_parse_int(optarg, "-1"))
 					++argerr;
 				else
 					attr_dampen = strdup(optarg);
 				break;
+			case 'R':
+				if (diskd_parse_range(optarg, MIN_REFRESH, MAX_REFRESH, &attr_refresh) < 0)
+					++argerr;
+				break;
+			case 'C':
+				if (diskd_parse_range(optarg, MIN_COALESCE, MAX_COALESCE, &attr_coalesce) < 0)
+					++argerr;
+				break;
+			case 'L':
+				if (diskd_parse_range(optarg, MIN_DEGRADED_MS, MAX_DEGRADED_MS, &degraded_ms) < 0)
+					++argerr;
+				break;
+			case 'F':
+				if (diskd_parse_factor(optarg, &degraded_factor) < 0)
+					++argerr;
+				break;
+			case 'K':
+				if (diskd_parse_range(optarg, MIN_DEGRADED_COUNT, MAX_DEGRADED_COUNT, &degraded_count) < 0)
+					++argerr;
+				break;
+			case 'f':
+				if (diskd_parse_window(optarg, &fail_n, &fail_m) < 0)
+					++argerr;
+				break;
+			case 'g':
+				if (diskd_parse_window(optarg, &recover_n, &recover_m) < 0)
+					++argerr;
+				break;
+			case 'n':
+				if (diskd_parse_range(optarg, MIN_SAMPLES, MAX_SAMPLES, &samples) < 0)
+					++argerr;
+				break;
+			case 'b':
+				if (diskd_parse_range(optarg, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, &block_size) < 0)
+					++argerr;
+				break;
+			case 'M':
+				if ((sample_mode = diskd_sample_parse_mode(optarg)) < 0)
+					++argerr;
+				break;
+			case 's':
+				if (diskd_parse_seed(optarg, &sample_seed) < 0)
+					++argerr;
+				break;
+			case 'W':
+				if ((write_mode = diskd_slot_parse_mode(optarg)) < 0)
+					++argerr;
+				break;
+			case 'Y':
+				if ((durability = diskd_slot_parse_durability(optarg)) < 0)
+					++argerr;
+				break;
+			case 'Z':
+				if (diskd_parse_range(optarg, MIN_SLOTS, MAX_SLOTS, &slots) < 0)
+					++argerr;
+				break;
+			case 'X':
+				verify_flag = 1;
+				break;
+			case 'P':
+				paths_flag = 1;
+				break;
+			case 'G':
+				if (diskd_parse_burst_spec(optarg) < 0)
+					++argerr;
+				break;
+			case 'A':
+				passive_flag = 1;
+				break;
+			case 'j':
+				if (diskd_parse_msec(optarg, MIN_INTERVAL, MAX_INTERVAL, &min_interval) < 0)
+					++argerr;
+				break;
+			case 'J':
+				if (diskd_parse_msec(optarg, MIN_INTERVAL, MAX_INTERVAL, &max_interval) < 0)
+					++argerr;
+				break;
+			case 'u':
+				if (diskd_parse_range(optarg, MIN_STUCK, MAX_STUCK, &worker_max_stuck) < 0)
+					++argerr;
+				break;
+			case 'x':
+				realtime_flag = TRUE;
+				break;
+			case 'y':
+				if (diskd_parse_range(optarg, MIN_RT_PRIORITY, MAX_RT_PRIORITY, &rt_priority) < 0)
+					++argerr;
+				break;
+			case 'O':
+				if (diskd_parse_range(optarg, MIN_DEADLINE, MAX_DEADLINE, &oneshot_deadline) < 0)
+					++argerr;
+				break;
+			case 'S':
+				ctl_socket = strdup(optarg);
+				break;
+			case 'B':
+				trace_file = strdup(optarg);
+				break;
+			case 'c':
+				if (diskd_parse_range(optarg, MIN_TRACE_RECORDS, MAX_TRACE_RECORDS, &trace_records) < 0)
+					++argerr;
+				break;
+			case 'Q':
+				query_cmd = strdup(optarg);
+				break;
 			case '?':
 				usage(crm_system_name, 1);
 				break;
@@ -732,14 +2997,41 @@ main(int argc, char **argv)
 		printf("\n");
 		argerr ++;
 	}
-	if ((argerr) || (optflag >= 2) || (device == NULL && wflag == FALSE)) {  /* add optflag 2008.10.24 */
-		/* "-N" + "-w" pattern and not "-N" + not "-w"*/
+	if (query_cmd != NULL) {
+		/* client of a running diskd */
+		if (argerr || ctl_socket == NULL) {
+			usage(crm_system_name, 1);
+		}
+		crm_exit(diskd_ctl_query(ctl_socket, query_cmd, timeout));
+	}
+
+	if ((argerr) || (optflag >= 2)
+	    || (device == NULL && wflag == FALSE && target_specs == NULL && config_file == NULL)) {  /* add optflag 2008.10.24 */
+		/* "-N" + "-w" pattern and not "-N" + not "-w" + not "-T" + not "-U" */
 		usage(crm_system_name, 1);
 	}
 	if ((device != NULL) && (wfile != NULL)) {
 		/* "-N" + "-d" pattern */
 		crm_warn("\"d\" option was ignored, because N option was specified.");
 	}
+	if (oneshot_deadline != 0 && !oneshot_flag) {
+		crm_warn("\"O\" option was ignored, because o option was not specified.");
+	}
+	if (rt_priority != 0 && !realtime_flag) {
+		crm_warn("\"y\" option was ignored, because x option was not specified.");
+	}
+	if (realtime_flag && oneshot_flag) {
+		crm_warn("\"x\" option was ignored, because o option was specified.");
+	}
+	if (trace_file != NULL && oneshot_flag) {
+		crm_warn("\"B\" option was ignored, because o option was specified.");
+	}
+
+	pagesize = getpagesize();
+	/* the -T specifications are kept for a reload */
+	if (diskd_targets_build(&targets) < 0) {
+		usage(crm_system_name, 1);
+	}
 
 	if (oneshot_flag) {
 		int rc = 0;
@@ -755,74 +3047,345 @@ main(int argc, char **argv)
 #else
         crm_make_daemon(crm_system_name, daemonize, pid_file);
 #endif
-	diskd_thread_timer_init();
+	/* before the timer thread and the workers, which inherit it */
+	diskd_rt_init();
+	if (trace_file != NULL && diskd_trace_open(trace_file, trace_records) < 0) {
+		crm_exit(1);
+	}
+	if (diskd_aio_init() < 0) {
+		crm_err("Could not initialize the %s I/O engine", diskd_aio_engine_name(io_engine));
+		crm_exit(1);
+	}
+	if (!diskd_attrd_connect()) {
+		diskd_attrd_schedule_reconnect();
+	}
+	if (diskd_ctl_init(ctl_socket) < 0) {
+		crm_exit(1);
+	}
 
-	if ( wflag ) {	/* writer */
-		if (wfile == NULL) {
-			wdir = strdup(WRITE_DIR);
-			wfile = calloc(1, PATH_MAX);
-			g_snprintf(wfile, PATH_MAX, "%s/%s", WRITE_DIR, WRITE_FILE);
-		}
-		buf = (void *)malloc(WRITE_DATA);
-		if (buf == NULL) {
-			crm_err("Could not allocate memory");
-			check_status(ERROR);
-			crm_exit(1);
+	if (io_engine != diskd_io_sync) {
+		if (exec_thread_flag) {
+			crm_info("\"e\" option was ignored, the I/O deadline is checked by the %s engine.",
+				diskd_aio_engine_name(io_engine));
 		}
-		diskcheck_wt(NULL);
-		timer_id = g_timeout_add(interval*1000, diskcheck_wt, NULL);
-	} else {	/* reader */
-		pagesize = getpagesize();
-		ptr = (void *)malloc(2 * pagesize);
-		if (ptr == NULL) {
+	} else {
+		diskd_thread_timer_init();
+	}
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (diskd_target_alloc_buf(target) < 0) {
 			crm_err("Could not allocate memory");
-			check_status(ERROR);
+			check_status(target, ERROR);
 			crm_exit(1);
 		}
-		buf = (void *)(((u_long)ptr + pagesize) & ~(pagesize-1));
-		diskcheck(NULL);
-		timer_id = g_timeout_add(interval*1000, diskcheck, NULL);
+	}
+	/* forked after the buffers are allocated, the workers use them */
+	if (io_engine == diskd_io_worker && diskd_worker_init(diskd_sync_attempt) < 0) {
+		crm_exit(1);
+	}
+	if (diskd_sched_init(diskd_target_timer) < 0) {
+		crm_exit(1);
+	}
+	start = g_get_monotonic_time();
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		target->result_time = start;
+		diskd_target_start(target, start + (gint64)target->phase * 1000);
 	}
 
 	crm_info("Starting %s", crm_system_name);
 	mainloop = g_main_new(FALSE);
 	g_main_run(mainloop);
 
-	free(ptr);
+	diskd_thread_timer_end();
+	diskd_worker_fini();
+	diskd_sched_fini();
+	g_list_free_full(targets, diskd_target_free);
+	targets = NULL;
+	diskd_aio_fini();
+	diskd_attrd_disconnect();
+	diskd_ctl_fini();
+	diskd_trace_close();
+	g_list_free_full(target_specs, free);
+	g_free(config_file);
+	free(trace_file);
+	free(ctl_socket);
 	free(pid_file);
 	if (wfile != NULL) {
 		free(wfile);
 	}
 
-	diskd_thread_timer_end();
-
 	crm_info("Exiting %s", crm_system_name);
 	return 0;
 }
 
-void
-send_update(void)
+static gboolean
+diskd_attrd_connect(void)
+{
+	if (attrd_ipc == NULL) {
+		attrd_ipc = crm_ipc_new(T_ATTRD, 0);
+		if (attrd_ipc == NULL) {
+			return FALSE;
+		}
+	}
+	if (crm_ipc_connected(attrd_ipc)) {
+		return TRUE;
+	}
+	if (!crm_ipc_connect(attrd_ipc)) {
+		crm_ipc_close(attrd_ipc);
+		attrd_stats.connect_failures++;
+		return FALSE;
+	}
+	crm_info("Connected to %s", T_ATTRD);
+	attrd_stats.connects++;
+	attrd_backoff = 0;
+	return TRUE;
+}
+
+gboolean
+diskd_attrd_connected(void)
+{
+	return attrd_ipc != NULL && crm_ipc_connected(attrd_ipc);
+}
+
+static void
+diskd_attrd_disconnect(void)
+{
+	if (attrd_reconnect_id != 0) {
+		g_source_remove(attrd_reconnect_id);
+		attrd_reconnect_id = 0;
+	}
+	if (attrd_flush_id != 0) {
+		g_source_remove(attrd_flush_id);
+		attrd_flush_id = 0;
+	}
+	if (attrd_ipc != NULL) {
+		crm_ipc_close(attrd_ipc);
+		crm_ipc_destroy(attrd_ipc);
+		attrd_ipc = NULL;
+	}
+}
+
+static gboolean
+diskd_attrd_reconnect(gpointer data)
+{
+	GList *gIter;
+
+	attrd_reconnect_id = 0;
+	if (!diskd_attrd_connect()) {
+		diskd_attrd_schedule_reconnect();
+		return FALSE;
+	}
+
+	/* attrd may have restarted and lost the values. send them all. */
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_lock(&diskd_mutex);
+#else
+		g_mutex_lock(diskd_mutex);
+#endif
+	}
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		target->sent_value = NULL;
+		target->paths_sent = -1;
+		target->burst_sent = FALSE;
+		if (diskd_attrd_need_update(target)) {
+			send_update(target);
+		}
+	}
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_unlock(&diskd_mutex);
+#else
+		g_mutex_unlock(diskd_mutex);
+#endif
+	}
+	return FALSE;
+}
+
+static void
+diskd_attrd_schedule_reconnect(void)
+{
+	if (attrd_reconnect_id != 0) {
+		return;
+	}
+	if (attrd_backoff == 0) {
+		attrd_backoff = ATTRD_BACKOFF_MIN;
+	} else {
+		attrd_backoff = MIN(attrd_backoff * 2, ATTRD_BACKOFF_MAX);
+	}
+	crm_warn("Could not connect to %s, retrying in %d sec", T_ATTRD, attrd_backoff);
+	attrd_reconnect_id = g_timeout_add(attrd_backoff * 1000, diskd_attrd_reconnect, NULL);
+}
+
+/* attrd does not have the current value, or it is time to refresh it */
+static gboolean
+diskd_attrd_need_update(diskd_target_t *target)
+{
+	if (target->parent != NULL) {
+		return FALSE;	/* published by its device */
+	}
+	if (target->paths_ok >= 0 && target->paths_sent != target->paths_ok) {
+		return TRUE;
+	}
+	if (target->mbps >= 0 && !target->burst_sent) {
+		return TRUE;
+	}
+	if (target->value == NULL) {
+		return FALSE;
+	}
+	if (target->sent_value != target->value) {
+		return TRUE;
+	}
+	return (attr_refresh > 0) && (g_get_monotonic_time() - target->sent_time
+		>= attr_refresh * G_TIME_SPAN_SECOND);
+}
+
+static gboolean
+diskd_attrd_flush(gpointer data)
+{
+	GList *gIter;
+
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_lock(&diskd_mutex);
+#else
+		g_mutex_lock(diskd_mutex);
+#endif
+	}
+	attrd_flush_id = 0;
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (diskd_attrd_need_update(target)) {
+			send_update(target);
+		}
+	}
+	if (diskd_thread_use == TRUE) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		g_mutex_unlock(&diskd_mutex);
+#else
+		g_mutex_unlock(diskd_mutex);
+#endif
+	}
+	return FALSE;
+}
+
+/*
+ * Called with the new value of a target.  An unchanged value is not sent
+ * until the refresh time.  With -C, the changes are sent together when
+ * the window closes, and a change that is reverted in the window is not
+ * sent at all.
+ */
+static void
+diskd_attrd_queue(diskd_target_t *target)
+{
+	if (!diskd_attrd_need_update(target)) {
+		crm_trace("%s=%s is not changed", target->attr, target->value);
+		attrd_stats.suppressed++;
+		return;
+	}
+	if (attr_coalesce == 0) {
+		send_update(target);
+	} else if (attrd_flush_id == 0) {
+		attrd_flush_id = g_timeout_add(attr_coalesce, diskd_attrd_flush, NULL);
+	}
+}
+
+/* A target went away. A failure only leaves the attribute behind. */
+static void
+diskd_attrd_delete(const char *attr)
 {
 	int rc;
 
-//#if ATTRD_UPDATE_BOTH
-	static gboolean boFirst = TRUE;
-//#else
-//	static gboolean boFirst = FALSE;
-//#endif
+	if (attrd_reconnect_id != 0 || !diskd_attrd_connect()) {
+		crm_warn("Could not delete %s, %s is not reachable", attr, T_ATTRD);
+		return;
+	}
+	rc = pcmk__node_attr_request(attrd_ipc, 'D', NULL, attr,
+		NULL, attr_section, attr_set, attr_dampen, NULL, attr_options);
+	if (pcmk_ok != rc) {
+		crm_err("Could not delete %s", attr);
+		attrd_stats.failures++;
+		return;
+	}
+	crm_info("Deleted %s", attr);
+	attrd_stats.updates++;
+}
+
+static gboolean
+diskd_attrd_send(const char *attr, const char *value, gboolean *first_update)
+{
+	int rc;
+	gint64 start = g_get_monotonic_time();
 
-	if (boFirst) {
-	    rc = pcmk__node_attr_request(NULL, 'B', NULL, diskd_attr,
-		diskcheck_value, attr_section, attr_set, attr_dampen, NULL, attr_options);
+	if (*first_update) {
+	    rc = pcmk__node_attr_request(attrd_ipc, 'B', NULL, attr,
+		value, attr_section, attr_set, attr_dampen, NULL, attr_options);
 	    if (rc == pcmk_ok) {
-			boFirst = FALSE;
+			*first_update = FALSE;
 	    }
 	} else {
-	    rc = pcmk__node_attr_request(NULL, 'U', NULL, diskd_attr,
-		diskcheck_value, attr_section, attr_set, attr_dampen, NULL, attr_options);
+	    rc = pcmk__node_attr_request(attrd_ipc, 'U', NULL, attr,
+		value, attr_section, attr_set, attr_dampen, NULL, attr_options);
 	}
 
+	diskd_hist_record(&attrd_stats.latency, g_get_monotonic_time() - start);
+
 	if (pcmk_ok != rc ) {
-		crm_err("Could not update %s=%s", diskd_attr, diskcheck_value);
+		crm_err("Could not update %s=%s", attr, value);
+		attrd_stats.failures++;
+		if (!crm_ipc_connected(attrd_ipc)) {
+			/* attrd has gone. reconnect in the background. */
+			crm_ipc_close(attrd_ipc);
+			diskd_attrd_schedule_reconnect();
+		}
+		return FALSE;
+	}
+	attrd_stats.updates++;
+	return TRUE;
+}
+
+void
+send_update(diskd_target_t *target)
+{
+	/* While waiting for a reconnect, the value is sent after it. */
+	if (attrd_reconnect_id != 0 || !diskd_attrd_connect()) {
+		target->sent_value = NULL;
+		target->paths_sent = -1;
+		target->burst_sent = FALSE;
+		attrd_stats.deferred++;
+		diskd_attrd_schedule_reconnect();
+		return;
+	}
+
+	if (target->value != NULL) {
+		if (!diskd_attrd_send(target->attr, target->value, &target->first_update)) {
+			target->sent_value = NULL;
+			return;
+		}
+		target->sent_value = target->value;
+		target->sent_time = g_get_monotonic_time();
+	}
+	if (target->paths_ok >= 0) {
+		if (!diskd_attrd_send(target->paths_attr, target->paths_value,
+			&target->paths_first_update)) {
+			target->paths_sent = -1;
+			return;
+		}
+		target->paths_sent = target->paths_ok;
+	}
+	if (target->mbps >= 0 && !target->burst_sent) {
+		if (!diskd_attrd_send(target->mbps_attr, target->mbps_value, &target->mbps_first_update)
+		    || !diskd_attrd_send(target->iops_attr, target->iops_value,
+			&target->iops_first_update)) {
+			return;
+		}
+		target->burst_sent = TRUE;
 	}
 }
@@ -0,0 +1,378 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Definitions shared by the diskd modules.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+#ifndef DISKD__H
+#  define DISKD__H
+
+#  include <sys/types.h>
+#  include <glib.h>
+#  include <diskd_trace.h>
+
+/* status */
+#define ERROR			1
+#define normal			-1
+#define NONE			2
+#define degraded		3	/* works, but slowly */
+
+/* probe type of a monitored target */
+enum diskd_probe_type {
+	diskd_probe_read,	/* read check of a device (-N) */
+	diskd_probe_write,	/* write check in a directory (-w/-d) */
+};
+
+/* I/O engine used by the probes */
+enum diskd_io_engine {
+	diskd_io_sync,		/* blocking read()/write() in the main loop */
+	diskd_io_aio,		/* Linux native AIO */
+	diskd_io_uring,		/* io_uring */
+	diskd_io_worker,	/* blocking I/O in a worker process per target */
+};
+
+/* phases of a probe timed into the histograms */
+enum diskd_phase {
+	diskd_phase_open,
+	diskd_phase_io,
+	diskd_phase_close,
+	diskd_phase_total,	/* whole attempt */
+	DISKD_PHASE_MAX
+};
+
+#define DISKD_HIST_BUCKETS	256
+#define DISKD_VOTE_MAX		64	/* longest voting window */
+#define MIN_SECTOR_SIZE		512	/* smallest O_DIRECT alignment */
+
+/* latency histogram. usec */
+typedef struct diskd_hist_s {
+	guint64 count;
+	guint64 sum;
+	guint64 min;
+	guint64 max;
+	guint32 buckets[DISKD_HIST_BUCKETS];
+} diskd_hist_t;
+
+/* how the write check writes */
+enum diskd_write_mode {
+	diskd_write_create,	/* create, write and remove a file every time */
+	diskd_write_slots,	/* rewrite slots of a preallocated file */
+};
+
+/* what makes a write of the write check durable */
+enum diskd_durability {
+	diskd_durability_dsync,		/* O_DSYNC */
+	diskd_durability_fdatasync,	/* fdatasync() after the write */
+	diskd_durability_rwf_dsync,	/* pwritev2() with RWF_DSYNC */
+};
+
+/* where the read check samples the device */
+enum diskd_sample_mode {
+	diskd_sample_head,	/* the first blocks */
+	diskd_sample_random,	/* random blocks over the whole device */
+	diskd_sample_stride,	/* evenly spaced blocks, shifted every cycle */
+};
+
+/* attribute updates sent to attrd */
+typedef struct diskd_attrd_stats_s {
+	guint64 updates;		/* requests attrd accepted */
+	guint64 failures;		/* requests that failed */
+	guint64 deferred;		/* values held back while attrd was unreachable */
+	guint64 suppressed;		/* unchanged values not sent */
+	guint64 connects;
+	guint64 connect_failures;
+	diskd_hist_t latency;		/* time of a request. usec */
+} diskd_attrd_stats_t;
+
+/* one segment of an asynchronous request */
+typedef struct diskd_aio_seg_s {
+	void *buf;
+	size_t len;
+	off_t offset;
+	int rw_flags;		/* RWF_* flags, e.g. RWF_DSYNC */
+} diskd_aio_seg_t;
+
+struct diskd_aio_batch_s;
+struct diskd_worker_s;
+struct diskd_burst_s;
+
+/* throughput burst of a target */
+typedef struct diskd_burst_conf_s {
+	int interval;		/* msec between bursts. 0 if off */
+	int depth;		/* requests in flight */
+	int block_size;		/* bytes */
+	int read_pct;		/* reads among the requests. 100 for a read target */
+	int duration;		/* msec. the burst stops after it */
+	int max_mb;		/* MB. nor does it move more */
+} diskd_burst_conf_t;
+
+/* result of a burst */
+typedef struct diskd_burst_result_s {
+	int error;		/* errno. 0 if all requests succeeded */
+	guint64 bytes;		/* moved by the completed requests */
+	guint64 ios;		/* completed requests */
+	gint64 elapsed;		/* usec */
+} diskd_burst_result_t;
+
+/* state of one monitored target */
+typedef struct diskd_target_s {
+	enum diskd_probe_type type;
+	char *path;		/* device name, or directory name to write */
+	char *wfile;		/* file name for write check */
+	char *attr;		/* name of the node attribute to set */
+	char *spec;		/* what it was built from. compared by a reload */
+	int interval;		/* msec, like all times of a target */
+	int min_interval;	/* bounds of the adaptive interval */
+	int max_interval;
+	int cur_interval;	/* interval until the next check */
+	int phase;		/* delay of the first check. -1 spreads the targets */
+	char *ioerr_path;	/* ioerr_cnt of the device in sysfs. "" if none */
+	guint64 ioerr_cnt;
+	gboolean ioerr_pending;	/* new errors found by the passive check, for the adapt */
+	int timeout;
+	int retry;
+	int retry_interval;
+	int status;		/* last status. ERROR, normal, degraded or NONE */
+	const char *value;	/* last attribute value */
+	gint64 result_time;	/* when value was set, or the start */
+	gboolean first_update;
+	const char *sent_value;	/* value attrd has. NULL if unknown */
+	gint64 sent_time;	/* when sent_value was sent */
+	gint64 due;		/* start of the next cycle. monotonic usec. 0 if none */
+	gint64 last_started;	/* due time of the cycle that started last */
+	void *ptr;
+	void *buf;
+	size_t buf_size;	/* bytes at buf */
+
+	/* asynchronous probe */
+	gboolean busy;		/* a check cycle is in progress */
+	gboolean voted;		/* the current cycle has voted. set under diskd_mutex */
+	int attempt;		/* attempt number in the current cycle */
+	guint deadline_id;	/* timer of the I/O deadline. 0 if not armed */
+	GSource *deadline;	/* its source, reused by each attempt */
+	guint retry_id;		/* timer of the next attempt */
+	struct diskd_aio_batch_s *io;	/* outstanding I/O, NULL if none */
+	struct diskd_aio_batch_s *io_batch;	/* reused by each attempt */
+	struct diskd_worker_s *worker;	/* probe worker. NULL if none */
+	gint64 probe_start;	/* start of the current attempt */
+	gint64 probe_mark;	/* end of the last timed phase */
+	gint64 last_latency;	/* whole time of the last attempt. usec. -1 if passive */
+	gint64 last_phase[DISKD_PHASE_MAX];	/* of the last attempt. usec. -1 if not reached */
+	int last_error;		/* errno of the last attempt. 0 if none */
+	gboolean timed_out;	/* the last attempt missed its deadline */
+
+	/* read sampling */
+	int samples;		/* blocks read per attempt */
+	int block_size;		/* bytes */
+	int sector_size;	/* O_DIRECT alignment of the device. 0 until known */
+	enum diskd_sample_mode sample_mode;
+	guint64 seed;
+	guint64 rng;		/* generator state, starts from seed */
+	diskd_aio_seg_t *segs;	/* samples of the current attempt */
+
+	/* write check */
+	enum diskd_write_mode write_mode;
+	enum diskd_durability durability;
+	int slots;		/* pages in the probe file */
+	int slot;		/* next slot to write */
+	gboolean prepared;	/* the probe file has been preallocated */
+	gboolean verify;	/* read each write back and check it */
+	gboolean verifying;	/* the read back is in flight */
+	guint64 write_seq;	/* sequence number of the last write */
+	diskd_aio_seg_t vseg;	/* the last write */
+	void *vbuf;		/* read back buffer */
+
+	/* paths of a multipath device */
+	gboolean check_paths;	/* check each slave of the device too */
+	struct diskd_target_s *parent;	/* device of a path target. NULL if none */
+	GList *paths;		/* path targets of the device */
+	char *paths_attr;	/* <attr>_paths_ok */
+	char paths_value[24];	/* "<ok>/<all>" */
+	int paths_ok;		/* -1 until every path has been checked */
+	int paths_sent;		/* paths_ok attrd has. -1 if unknown */
+	gboolean paths_first_update;
+
+	/* passive check */
+	gboolean passive;	/* skip the probe when others' I/O completes */
+	char *stat_path;	/* stat of the device in sysfs. "" if none */
+	gboolean stat_sampled;
+	guint64 stat_done;	/* completed requests at the last sample */
+	gint64 stat_time;	/* time of the last sample */
+	gint64 stall_since;	/* requests in flight and none completed. 0 if not */
+	int passive_run;	/* cycles skipped since the last probe */
+
+	/* voting over the last cycles */
+	int fail_n;		/* failed cycles of the last fail_m to set ERROR */
+	int fail_m;
+	int recover_n;		/* good cycles of the last recover_m to clear it */
+	int recover_m;
+	guint64 votes;		/* a bit per cycle, set if it failed. newest in bit 0 */
+	int vote_count;		/* cycles in votes, up to DISKD_VOTE_MAX */
+
+	/* degraded detection */
+	int degraded_ms;	/* absolute threshold. 0=off */
+	double degraded_factor;	/* threshold relative to baseline. 0=off */
+	int degraded_count;	/* consecutive probes to enter or leave */
+	gboolean is_degraded;
+	int slow_count;
+	int fast_count;
+	gint64 baseline;	/* EWMA of the latency. usec */
+	int baseline_samples;
+
+	/* statistics */
+	guint64 probes;		/* attempts */
+	guint64 probes_ok;
+	guint64 timeouts;
+	guint64 verify_errors;
+	guint64 passive_skips;	/* checks answered by the I/O of others */
+	guint64 stalls;		/* stalls found without a probe */
+	guint64 error_events;	/* changes to ERROR */
+	guint64 recoveries;	/* changes from ERROR */
+	gint64 fail_since;	/* start of the first failed attempt. 0 if healthy */
+	diskd_hist_t hist[DISKD_PHASE_MAX];
+	diskd_hist_t detect;	/* first failed attempt to ERROR. usec */
+	diskd_hist_t jitter;	/* how late the cycles started. usec */
+
+	/* throughput burst */
+	diskd_burst_conf_t burst;
+	guint burst_id;		/* timer of the next burst */
+	struct diskd_burst_s *burst_run;	/* burst in progress. NULL if none */
+	char *mbps_attr;	/* <attr>_mbps */
+	char *iops_attr;	/* <attr>_iops */
+	gint64 mbps;		/* of the last burst. -1 if none yet */
+	gint64 iops;
+	char mbps_value[24];
+	char iops_value[24];
+	gboolean burst_sent;	/* attrd has mbps and iops */
+	gboolean mbps_first_update;
+	gboolean iops_first_update;
+	guint64 bursts;
+	guint64 burst_failures;	/* failed or killed at the deadline */
+	guint64 burst_skips;	/* not started, the last one is still running */
+} diskd_target_t;
+
+/* called when all segments of a request completed. error is 0 or errno.
+ * The callback owns fd. */
+typedef void (*diskd_aio_done_fn)(diskd_target_t *target, int fd, int error);
+
+/* result of an attempt made by a probe worker */
+typedef struct diskd_worker_result_s {
+	int status;			/* normal or ERROR */
+	gint64 phase[DISKD_PHASE_MAX];	/* usec. -1 if not reached */
+	guint64 verify_errors;		/* found by the attempt */
+	int error;			/* errno of a failed attempt */
+} diskd_worker_result_t;
+
+/* makes one attempt in a worker. returns normal or ERROR */
+typedef int (*diskd_worker_probe_fn)(diskd_target_t *target);
+typedef void (*diskd_worker_done_fn)(diskd_target_t *target,
+	const diskd_worker_result_t *result);
+
+/* called when a burst of target ended. result is NULL if it was killed */
+typedef void (*diskd_burst_done_fn)(diskd_target_t *target, const diskd_burst_result_t *result);
+
+/* called when a cycle of target is due */
+typedef void (*diskd_sched_fn)(diskd_target_t *target);
+
+extern GList *targets;
+extern enum diskd_io_engine io_engine;
+extern int pagesize;
+extern diskd_attrd_stats_t attrd_stats;
+extern int worker_max_stuck;
+extern gboolean realtime_flag;
+extern int rt_priority;
+
+gboolean diskd_attrd_connected(void);
+int diskd_reload(GString *out);
+int diskd_vote_count(const diskd_target_t *target, gboolean failed, int window);
+
+int diskd_aio_parse_engine(const char *name);
+const char *diskd_aio_engine_name(enum diskd_io_engine engine);
+int diskd_aio_init(void);
+void diskd_aio_fini(void);
+int diskd_aio_submit(diskd_target_t *target, int fd, gboolean write,
+	const diskd_aio_seg_t *segs, int nsegs, diskd_aio_done_fn done);
+void diskd_aio_abandon(diskd_target_t *target);
+void diskd_aio_orphan(diskd_target_t *target);
+int diskd_aio_prealloc(diskd_target_t *target);
+
+const char *diskd_phase_name(enum diskd_phase phase);
+void diskd_hist_record(diskd_hist_t *hist, gint64 value);
+void diskd_hist_reset(diskd_hist_t *hist);
+guint64 diskd_hist_bucket_value(int index);
+guint64 diskd_hist_percentile(const diskd_hist_t *hist, double pct);
+void diskd_hist_summary(GString *out, const diskd_hist_t *hist);
+void diskd_hist_buckets(GString *out, const diskd_hist_t *hist);
+
+int diskd_sample_parse_mode(const char *name);
+const char *diskd_sample_mode_name(enum diskd_sample_mode mode);
+void diskd_sample_reset(diskd_target_t *target);
+int diskd_sample_plan(diskd_target_t *target, int fd);
+int diskd_sample_size(int fd, guint64 *size);
+int diskd_sample_sector(int fd);
+guint64 diskd_sample_next(diskd_target_t *target);
+
+int diskd_slot_parse_mode(const char *name);
+int diskd_slot_parse_durability(const char *name);
+const char *diskd_slot_durability_name(enum diskd_durability durability);
+int diskd_slot_open(diskd_target_t *target);
+void diskd_slot_next(diskd_target_t *target, diskd_aio_seg_t *seg, gboolean async);
+int diskd_slot_write(diskd_target_t *target, int fd);
+int diskd_slot_verify(diskd_target_t *target);
+
+guint32 diskd_crc32c(const void *buf, size_t len);
+
+GList *diskd_paths_discover(diskd_target_t *target);
+gboolean diskd_paths_update(diskd_target_t *target);
+
+int diskd_stat_read(diskd_target_t *target, guint64 *done, guint64 *inflight);
+
+int diskd_sched_init(diskd_sched_fn fn);
+void diskd_sched_fini(void);
+void diskd_sched_add(diskd_target_t *target, gint64 due);
+void diskd_sched_remove(diskd_target_t *target);
+
+int diskd_worker_init(diskd_worker_probe_fn probe);
+void diskd_worker_fini(void);
+int diskd_worker_spawn(diskd_target_t *target);
+int diskd_worker_submit(diskd_target_t *target, diskd_worker_done_fn done);
+void diskd_worker_abandon(diskd_target_t *target);
+void diskd_worker_stop(diskd_target_t *target);
+void diskd_worker_summary(GString *out);
+
+int diskd_trace_open(const char *path, int records);
+void diskd_trace_close(void);
+void diskd_trace_record(diskd_target_t *target, enum diskd_trace_result result, int error);
+
+int diskd_burst_start(diskd_target_t *target, diskd_burst_done_fn done);
+void diskd_burst_stop(diskd_target_t *target);
+
+int diskd_rt_init(void);
+void diskd_rt_child(void);
+void diskd_rt_drop(void);
+void diskd_rt_summary(GString *out);
+
+int diskd_config_read(const char *file, GList **specs);
+
+int diskd_ctl_init(const char *path);
+void diskd_ctl_fini(void);
+int diskd_ctl_query(const char *path, const char *cmd, int timeout);
+
+#endif
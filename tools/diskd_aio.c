@@ -0,0 +1,492 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Asynchronous probe I/O (io_uring, or Linux native AIO).
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * The probes submit their I/O here and return to the main loop.  The
+ * completion is reported through an eventfd watched by the main loop, so
+ * a hung device never blocks the daemon.  The caller arms its own deadline
+ * and calls diskd_aio_abandon() when it expires; the abandoned request
+ * stays attached to the target until the kernel completes it, so that the
+ * buffer is not reused while the device may still write into it.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/aio_abi.h>
+#ifdef HAVE_LIBURING
+#  include <liburing.h>
+#endif
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define DISKD_AIO_DEPTH		256	/* max. segments in flight */
+#define DISKD_AIO_EVENTS	32	/* completions reaped at once */
+
+typedef struct diskd_aio_req_s {
+	struct diskd_aio_batch_s *batch;
+	size_t len;
+	gboolean done;
+	struct iocb iocb;
+} diskd_aio_req_t;
+
+typedef struct diskd_aio_batch_s {
+	diskd_target_t *target;	/* NULL when orphaned */
+	gboolean abandoned;	/* the caller no longer waits for it */
+	int fd;
+	int nsegs;
+	int capacity;		/* segments it was allocated for */
+	int pending;
+	int error;
+	diskd_aio_done_fn done;
+	void *owned_buf;	/* buffer freed on completion when orphaned */
+	diskd_aio_req_t reqs[];
+} diskd_aio_batch_t;
+
+enum diskd_io_engine io_engine = diskd_io_sync;
+
+static int aio_efd = -1;
+static guint aio_watch_id = 0;
+static int aio_outstanding = 0;		/* batches not yet completed */
+static aio_context_t aio_ctx = 0;
+#ifdef HAVE_LIBURING
+static struct io_uring aio_ring;
+#endif
+
+int diskd_aio_parse_engine(const char *name)
+{
+	if (strcmp(name, "sync") == 0) {
+		io_engine = diskd_io_sync;
+	} else if (strcmp(name, "aio") == 0) {
+		io_engine = diskd_io_aio;
+	} else if (strcmp(name, "uring") == 0 || strcmp(name, "auto") == 0) {
+		io_engine = diskd_io_uring;
+	} else if (strcmp(name, "worker") == 0) {
+		io_engine = diskd_io_worker;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+const char *diskd_aio_engine_name(enum diskd_io_engine engine)
+{
+	switch (engine) {
+		case diskd_io_aio:
+			return "aio";
+		case diskd_io_uring:
+			return "uring";
+		case diskd_io_worker:
+			return "worker";
+		default:
+			return "sync";
+	}
+}
+
+static void diskd_aio_complete(diskd_aio_req_t *req, long res)
+{
+	diskd_aio_batch_t *batch = req->batch;
+	diskd_target_t *target = batch->target;
+
+	if (req->done) {
+		return;
+	}
+	req->done = TRUE;
+
+	if (res < 0) {
+		if (batch->error == 0) {
+			batch->error = -res;
+		}
+	} else if ((size_t)res != req->len) {
+		if (batch->error == 0) {
+			batch->error = EIO;	/* short read or write */
+		}
+	}
+	if (--batch->pending > 0) {
+		return;
+	}
+
+	aio_outstanding--;
+
+	if (target != NULL) {
+		target->io = NULL;
+	}
+	if (target == NULL || batch->abandoned) {
+		crm_info("Abandoned I/O on %s completed, error=%d",
+			target ? target->path : "removed target", batch->error);
+		close(batch->fd);
+	} else {
+		batch->done(target, batch->fd, batch->error);
+	}
+	if (target == NULL) {
+		free(batch->owned_buf);
+		g_free(batch);
+	}
+}
+
+static void diskd_aio_reap(void)
+{
+#ifdef HAVE_LIBURING
+	if (io_engine == diskd_io_uring) {
+		struct io_uring_cqe *cqe;
+
+		while (io_uring_peek_cqe(&aio_ring, &cqe) == 0) {
+			diskd_aio_req_t *req = io_uring_cqe_get_data(cqe);
+			long res = cqe->res;
+
+			io_uring_cqe_seen(&aio_ring, cqe);
+			if (req != NULL) {	/* NULL is a cancel request */
+				diskd_aio_complete(req, res);
+			}
+		}
+		return;
+	}
+#endif
+	while (1) {
+		struct io_event events[DISKD_AIO_EVENTS];
+		struct timespec ts = { 0, 0 };
+		int i, n;
+
+		n = syscall(SYS_io_getevents, aio_ctx, 0, DISKD_AIO_EVENTS, events, &ts);
+		if (n <= 0) {
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			diskd_aio_complete((diskd_aio_req_t *)(uintptr_t)events[i].data, events[i].res);
+		}
+	}
+}
+
+static gboolean diskd_aio_dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	uint64_t count;
+
+	if (read(aio_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		crm_perror(LOG_ERR, "read of the completion eventfd failed");
+	}
+	diskd_aio_reap();
+	return TRUE;
+}
+
+int diskd_aio_init(void)
+{
+	GIOChannel *channel;
+
+	if (io_engine == diskd_io_sync || io_engine == diskd_io_worker) {
+		return 0;
+	}
+
+	aio_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (aio_efd < 0) {
+		crm_perror(LOG_ERR, "Could not create eventfd");
+		return -1;
+	}
+
+#ifdef HAVE_LIBURING
+	if (io_engine == diskd_io_uring) {
+		int rc = io_uring_queue_init(DISKD_AIO_DEPTH, &aio_ring, 0);
+
+		if (rc == 0) {
+			rc = io_uring_register_eventfd(&aio_ring, aio_efd);
+			if (rc < 0) {
+				io_uring_queue_exit(&aio_ring);
+			}
+		}
+		if (rc < 0) {
+			crm_warn("io_uring is not available (%s), using aio", strerror(-rc));
+			io_engine = diskd_io_aio;
+		}
+	}
+#else
+	if (io_engine == diskd_io_uring) {
+		crm_info("diskd was built without io_uring support, using aio");
+		io_engine = diskd_io_aio;
+	}
+#endif
+
+	if (io_engine == diskd_io_aio) {
+		if (syscall(SYS_io_setup, DISKD_AIO_DEPTH, &aio_ctx) < 0) {
+			crm_perror(LOG_ERR, "io_setup failed");
+			close(aio_efd);
+			aio_efd = -1;
+			return -1;
+		}
+	}
+
+	channel = g_io_channel_unix_new(aio_efd);
+	aio_watch_id = g_io_add_watch(channel, G_IO_IN, diskd_aio_dispatch, NULL);
+	g_io_channel_unref(channel);
+
+	crm_info("Using %s I/O engine", diskd_aio_engine_name(io_engine));
+	return 0;
+}
+
+void diskd_aio_fini(void)
+{
+	if (aio_efd < 0) {
+		return;
+	}
+	if (aio_watch_id != 0) {
+		g_source_remove(aio_watch_id);
+		aio_watch_id = 0;
+	}
+	/* Tearing down the context waits for the I/O still in flight. */
+	if (aio_outstanding == 0) {
+#ifdef HAVE_LIBURING
+		if (io_engine == diskd_io_uring) {
+			io_uring_queue_exit(&aio_ring);
+		}
+#endif
+		if (io_engine == diskd_io_aio) {
+			syscall(SYS_io_destroy, aio_ctx);
+		}
+		close(aio_efd);
+	} else {
+		crm_warn("%d I/O request(s) are still outstanding", aio_outstanding);
+	}
+	aio_efd = -1;
+}
+
+static diskd_aio_batch_t *diskd_aio_batch_new(int capacity)
+{
+	diskd_aio_batch_t *batch;
+
+	batch = g_malloc0(sizeof(diskd_aio_batch_t) + capacity * sizeof(diskd_aio_req_t));
+	batch->capacity = capacity;
+	return batch;
+}
+
+/*
+ * Allocate the batch of a target in advance.  It is reused by each
+ * attempt, so that a check cycle allocates nothing.
+ */
+int diskd_aio_prealloc(diskd_target_t *target)
+{
+	int capacity = MIN(MAX(target->samples, 1), DISKD_AIO_DEPTH);
+
+	if (io_engine != diskd_io_aio && io_engine != diskd_io_uring) {
+		return 0;
+	}
+	if (target->io_batch == NULL) {
+		target->io_batch = diskd_aio_batch_new(capacity);
+	}
+	return 0;
+}
+
+/*
+ * Submit the segments as one batch.  On success fd is handed back to the
+ * callback when every segment completed, or closed here if the batch was
+ * abandoned.  Returns a negative errno, also set to errno, when nothing
+ * was submitted; fd is left to the caller in that case.
+ */
+int diskd_aio_submit(diskd_target_t *target, int fd, gboolean write,
+	const diskd_aio_seg_t *segs, int nsegs, diskd_aio_done_fn done)
+{
+	diskd_aio_batch_t *batch;
+	int i, rc;
+
+	if (target->io != NULL || nsegs <= 0 || nsegs > DISKD_AIO_DEPTH) {
+		errno = EBUSY;
+		return -EBUSY;
+	}
+
+	batch = target->io_batch;
+	if (batch == NULL || batch->capacity < nsegs) {
+		g_free(batch);
+		batch = diskd_aio_batch_new(nsegs);
+		target->io_batch = batch;
+	} else {
+		int capacity = batch->capacity;
+
+		memset(batch, 0, sizeof(diskd_aio_batch_t) + nsegs * sizeof(diskd_aio_req_t));
+		batch->capacity = capacity;
+	}
+	batch->target = target;
+	batch->fd = fd;
+	batch->nsegs = nsegs;
+	batch->pending = nsegs;
+	batch->done = done;
+	for (i = 0; i < nsegs; i++) {
+		batch->reqs[i].batch = batch;
+		batch->reqs[i].len = segs[i].len;
+	}
+
+#ifdef HAVE_LIBURING
+	if (io_engine == diskd_io_uring) {
+		struct io_uring_sqe *sqes[nsegs];
+
+		if (io_uring_sq_space_left(&aio_ring) < (unsigned)nsegs) {
+			errno = EAGAIN;
+			return -EAGAIN;
+		}
+		for (i = 0; i < nsegs; i++) {
+			struct io_uring_sqe *sqe = io_uring_get_sqe(&aio_ring);
+
+			sqes[i] = sqe;
+
+			if (write) {
+				io_uring_prep_write(sqe, fd, segs[i].buf, segs[i].len, segs[i].offset);
+			} else {
+				io_uring_prep_read(sqe, fd, segs[i].buf, segs[i].len, segs[i].offset);
+			}
+			sqe->rw_flags = segs[i].rw_flags;
+			io_uring_sqe_set_data(sqe, &batch->reqs[i]);
+		}
+		rc = io_uring_submit(&aio_ring);
+		if (rc < 0) {
+			/* The entries stay queued and would go out with the next
+			 * submission, after the caller closed fd: make them no-ops. */
+			crm_warn("io_uring_submit failed: %s", strerror(-rc));
+			for (i = 0; i < nsegs; i++) {
+				io_uring_prep_nop(sqes[i]);
+				io_uring_sqe_set_data(sqes[i], NULL);
+			}
+			errno = -rc;
+			return rc;
+		}
+		aio_outstanding++;
+		target->io = batch;
+		return 0;
+	}
+#endif
+
+	{
+		struct iocb *list[nsegs];
+
+		for (i = 0; i < nsegs; i++) {
+			struct iocb *cb = &batch->reqs[i].iocb;
+
+			cb->aio_data = (uintptr_t)&batch->reqs[i];
+			cb->aio_fildes = fd;
+			cb->aio_lio_opcode = write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+			cb->aio_buf = (uintptr_t)segs[i].buf;
+			cb->aio_nbytes = segs[i].len;
+			cb->aio_offset = segs[i].offset;
+			cb->aio_rw_flags = segs[i].rw_flags;
+			cb->aio_flags = IOCB_FLAG_RESFD;
+			cb->aio_resfd = aio_efd;
+			list[i] = cb;
+		}
+		rc = syscall(SYS_io_submit, aio_ctx, nsegs, list);
+		if (rc <= 0) {
+			if (rc == 0) {
+				errno = EAGAIN;
+			}
+			return -errno;
+		}
+		aio_outstanding++;
+		target->io = batch;
+		/* segments the kernel did not take fail the batch */
+		for (i = rc; i < nsegs; i++) {
+			diskd_aio_complete(&batch->reqs[i], -EAGAIN);
+		}
+	}
+	return 0;
+}
+
+static void diskd_aio_cancel(diskd_aio_batch_t *batch)
+{
+	int i;
+
+#ifdef HAVE_LIBURING
+	if (io_engine == diskd_io_uring) {
+		for (i = 0; i < batch->nsegs; i++) {
+			struct io_uring_sqe *sqe;
+
+			if (batch->reqs[i].done) {
+				continue;
+			}
+			sqe = io_uring_get_sqe(&aio_ring);
+			if (sqe == NULL) {
+				break;
+			}
+			io_uring_prep_cancel(sqe, &batch->reqs[i], 0);
+			io_uring_sqe_set_data(sqe, NULL);
+		}
+		io_uring_submit(&aio_ring);
+		return;
+	}
+#endif
+	{
+		int nsegs = batch->nsegs;
+		int pending = batch->pending;
+
+		/* the batch is freed when its last segment completes */
+		for (i = 0; i < nsegs && pending > 0; i++) {
+			struct io_event event;
+			diskd_aio_req_t *req = &batch->reqs[i];
+
+			if (req->done) {
+				continue;
+			}
+			/* Most block drivers do not support cancellation; EINVAL is usual. */
+			if (syscall(SYS_io_cancel, aio_ctx, &req->iocb, &event) == 0) {
+				pending--;
+				diskd_aio_complete(req, event.res);
+			}
+		}
+	}
+}
+
+/* The caller gave up waiting: no callback, but keep the target busy. */
+void diskd_aio_abandon(diskd_target_t *target)
+{
+	diskd_aio_batch_t *batch = target->io;
+
+	if (batch == NULL || batch->abandoned) {
+		return;
+	}
+	batch->abandoned = TRUE;
+	diskd_aio_cancel(batch);
+}
+
+/*
+ * The target goes away: the batch takes over the buffer it may still use,
+ * and is freed on completion.
+ */
+void diskd_aio_orphan(diskd_target_t *target)
+{
+	diskd_aio_batch_t *batch = target->io;
+
+	if (batch == NULL) {
+		g_free(target->io_batch);
+		target->io_batch = NULL;
+		return;
+	}
+	target->io_batch = NULL;
+	batch->abandoned = TRUE;
+	batch->target = NULL;
+	batch->owned_buf = target->ptr;
+	target->ptr = NULL;
+	target->buf = NULL;
+	target->io = NULL;
+	diskd_aio_cancel(batch);
+}
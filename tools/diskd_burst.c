@@ -0,0 +1,306 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Throughput bursts.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * A burst keeps depth O_DIRECT requests in flight for duration, or until
+ * max-mb were moved, and reports how many bytes and requests completed.
+ * It runs in a process of its own with its own AIO context, so that it
+ * neither blocks the daemon nor shares anything with the probes, and it
+ * is killed if it is not done shortly after its duration.  A read target
+ * is only read.  A write target writes a file of up to max-mb next to
+ * its check file, and reads back only what was written to it before.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/aio_abi.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define BURST_GRACE		2000	/* msec after the duration until it is killed */
+#define BURST_FILE_SUFFIX	".burst"
+
+/* a burst in progress */
+typedef struct diskd_burst_s {
+	diskd_target_t *target;	/* NULL when the target went away */
+	pid_t pid;
+	int fd;			/* the result is read from it */
+	guint kill_id;		/* timer of the kill */
+	gboolean killed;
+	diskd_burst_done_fn done;
+} diskd_burst_t;
+
+static gint64 diskd_burst_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the file of a write target, and the path of a read target */
+static char *diskd_burst_path(diskd_target_t *target)
+{
+	if (target->type == diskd_probe_write) {
+		return g_strdup_printf("%s%s", target->wfile, BURST_FILE_SUFFIX);
+	}
+	return g_strdup(target->path);
+}
+
+/* Body of the burst process. */
+static void diskd_burst_run(diskd_target_t *target, diskd_burst_result_t *result)
+{
+	const diskd_burst_conf_t *conf = &target->burst;
+	gboolean write_target = (target->type == diskd_probe_write);
+	guint64 bsize = conf->block_size, budget = (guint64)conf->max_mb << 20;
+	guint64 span, filled = 0, submitted = 0;
+	struct iocb *cbs;
+	char *bufs = NULL;
+	char *path = diskd_burst_path(target);
+	aio_context_t ctx = 0;
+	gint64 start, deadline, now;
+	int fd, i, sector, inflight = 0;
+
+	fd = open(path, write_target ? (O_RDWR | O_CREAT | O_DIRECT) : (O_RDONLY | O_DIRECT), 0600);
+	if (fd < 0) {
+		result->error = errno;
+		return;
+	}
+	if (diskd_sample_size(fd, &span) < 0 || (sector = diskd_sample_sector(fd)) < 0) {
+		result->error = errno;
+		close(fd);
+		return;
+	}
+	/* O_DIRECT needs whole logical blocks */
+	bsize = (bsize + sector - 1) / sector * sector;
+	if (write_target) {
+		/* the file grows up to the budget of one burst */
+		filled = span - span % bsize;
+		span = budget;
+	}
+	span -= span % bsize;
+	if (span < bsize) {
+		result->error = ENOSPC;
+		close(fd);
+		return;
+	}
+
+	cbs = calloc(conf->depth, sizeof(struct iocb));
+	if (cbs == NULL || posix_memalign((void **)&bufs, pagesize, (size_t)conf->depth * bsize) != 0
+	    || syscall(SYS_io_setup, conf->depth, &ctx) < 0) {
+		result->error = errno ? errno : ENOMEM;
+		close(fd);
+		return;
+	}
+	memset(bufs, 0x5a, (size_t)conf->depth * bsize);
+
+	start = diskd_burst_now();
+	deadline = start + (gint64)conf->duration * 1000;
+	now = start;
+	while (1) {
+		struct io_event events[conf->depth];
+		struct timespec ts;
+		int n;
+
+		/* keep depth requests in flight within the budget */
+		for (i = 0; i < conf->depth && now < deadline && submitted + bsize <= budget; i++) {
+			struct iocb *cb = &cbs[i], *list[1] = { cb };
+			gboolean read;
+
+			if (cb->aio_data != 0) {
+				continue;	/* in flight */
+			}
+			read = ((int)(diskd_sample_next(target) % 100) < conf->read_pct);
+			memset(cb, 0, sizeof(*cb));
+			cb->aio_data = 1;
+			cb->aio_fildes = fd;
+			cb->aio_buf = (uintptr_t)(bufs + (size_t)i * bsize);
+			cb->aio_nbytes = bsize;
+			if (read && (!write_target || filled >= bsize)) {
+				guint64 limit = write_target ? filled : span;
+
+				cb->aio_lio_opcode = IOCB_CMD_PREAD;
+				cb->aio_offset = (diskd_sample_next(target) % (limit / bsize)) * bsize;
+			} else if (filled < span) {
+				/* grow the file, so that the reads hit written blocks */
+				cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+				cb->aio_offset = filled;
+				filled += bsize;
+			} else {
+				cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+				cb->aio_offset = (diskd_sample_next(target) % (span / bsize)) * bsize;
+			}
+			if (syscall(SYS_io_submit, ctx, 1, list) != 1) {
+				cb->aio_data = 0;
+				result->error = errno;
+				deadline = now;	/* drain and stop */
+				break;
+			}
+			inflight++;
+			submitted += bsize;
+		}
+		if (inflight == 0) {
+			break;
+		}
+
+		/* past the deadline it waits for the last requests; the daemon kills it */
+		ts.tv_sec = 0;
+		ts.tv_nsec = (now < deadline) ? MIN(deadline - now, 100000) * 1000 : 100000000;
+		n = syscall(SYS_io_getevents, ctx, 1, conf->depth, events, &ts);
+		if (n < 0 && errno != EINTR) {
+			result->error = errno;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			struct iocb *cb = (struct iocb *)(uintptr_t)events[i].obj;
+
+			cb->aio_data = 0;
+			inflight--;
+			if (events[i].res == (gint64)bsize) {
+				result->bytes += bsize;
+				result->ios++;
+			} else if (result->error == 0) {
+				result->error = (events[i].res < 0) ? -events[i].res : EIO;
+			}
+		}
+		now = diskd_burst_now();
+	}
+	result->elapsed = diskd_burst_now() - start;
+	syscall(SYS_io_destroy, ctx);
+	close(fd);
+}
+
+static void diskd_burst_free(diskd_burst_t *burst)
+{
+	if (burst->kill_id != 0) {
+		g_source_remove(burst->kill_id);
+	}
+	close(burst->fd);
+	free(burst);
+}
+
+static void diskd_burst_exited(GPid pid, gint status, gpointer data)
+{
+	diskd_burst_t *burst = data;
+	diskd_target_t *target = burst->target;
+	diskd_burst_result_t result;
+	gboolean got;
+
+	g_spawn_close_pid(pid);
+	got = !burst->killed && read(burst->fd, &result, sizeof(result)) == sizeof(result);
+	if (target == NULL) {
+		crm_info("Burst process %d of a removed target has exited", (int)pid);
+	} else {
+		target->burst_run = NULL;
+		burst->done(target, got ? &result : NULL);
+	}
+	diskd_burst_free(burst);
+}
+
+static gboolean diskd_burst_kill(gpointer data)
+{
+	diskd_burst_t *burst = data;
+
+	burst->kill_id = 0;
+	burst->killed = TRUE;
+	crm_warn("Burst on %s did not end in time, killing process %d",
+		burst->target ? burst->target->path : "removed target", (int)burst->pid);
+	kill(burst->pid, SIGKILL);
+	return FALSE;
+}
+
+/* Start a burst. done is called when it has ended. */
+int diskd_burst_start(diskd_target_t *target, diskd_burst_done_fn done)
+{
+	diskd_burst_t *burst;
+	int fds[2];
+	pid_t pid;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		crm_perror(LOG_ERR, "Could not create a pipe for the burst on %s", target->path);
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		crm_perror(LOG_ERR, "Could not fork the burst on %s", target->path);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		diskd_burst_result_t result;
+
+		close(fds[0]);
+		signal(SIGTERM, SIG_DFL);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		diskd_rt_drop();	/* it must not push the others aside */
+		memset(&result, 0, sizeof(result));
+		diskd_burst_run(target, &result);
+		if (write(fds[1], &result, sizeof(result)) < 0) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	burst = calloc(1, sizeof(diskd_burst_t));
+	burst->target = target;
+	burst->pid = pid;
+	burst->fd = fds[0];
+	burst->done = done;
+	burst->kill_id = g_timeout_add(target->burst.duration + BURST_GRACE, diskd_burst_kill, burst);
+	g_child_watch_add(pid, diskd_burst_exited, burst);
+	target->burst_run = burst;
+	crm_debug("Started burst process %d on %s", (int)pid, target->path);
+	return 0;
+}
+
+/* The target goes away: kill its burst, which frees itself when it exits. */
+void diskd_burst_stop(diskd_target_t *target)
+{
+	diskd_burst_t *burst = target->burst_run;
+
+	if (burst == NULL) {
+		return;
+	}
+	burst->target = NULL;
+	burst->killed = TRUE;
+	if (burst->kill_id != 0) {
+		g_source_remove(burst->kill_id);
+		burst->kill_id = 0;
+	}
+	kill(burst->pid, SIGKILL);
+	target->burst_run = NULL;
+}
@@ -0,0 +1,165 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Config file of the targets.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * The file given by -U is a key file.  Each group is a target, named by
+ * the attribute it sets, with a "read" key (device) or a "write" key
+ * (directory) and any other key of -T.  The keys of a [defaults] group
+ * apply to every target that does not have them:
+ *
+ *   [defaults]
+ *   interval = 10
+ *   timeout = 30
+ *
+ *   [diskd_sdb]
+ *   read = /dev/sdb
+ *   paths = true
+ *
+ * Each target becomes a -T specification with its keys sorted, so that
+ * the same target always gives the same string, however the file is
+ * written.  A reload compares them to find what changed.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define CONFIG_DEFAULTS		"defaults"
+
+/* a value that can be put into a target specification */
+static gboolean diskd_config_valid(const char *value)
+{
+	return value[0] != '\0' && strchr(value, ',') == NULL && strchr(value, '=') == NULL;
+}
+
+/* The specification of the target of group. NULL if it is invalid. */
+static char *diskd_config_target(GKeyFile *kf, const char *file, const char *group)
+{
+	const char *groups[] = { group, CONFIG_DEFAULTS };
+	char *type = NULL, *path = NULL, *spec = NULL;
+	GList *items = NULL, *gIter;
+	gboolean valid = diskd_config_valid(group);
+	GString *out;
+	int i, j;
+
+	if (!valid) {
+		crm_err("%s: invalid target name [%s]", file, group);
+	}
+	for (i = 0; i < 2 && valid; i++) {
+		gchar **keys = g_key_file_get_keys(kf, groups[i], NULL, NULL);
+
+		for (j = 0; keys != NULL && keys[j] != NULL && valid; j++) {
+			const char *key = keys[j];
+			gchar *value;
+
+			if (i != 0 && g_key_file_has_key(kf, group, key, NULL)) {
+				continue;	/* the target has its own */
+			}
+			value = g_key_file_get_value(kf, groups[i], key, NULL);
+			if (value == NULL || !diskd_config_valid(value)) {
+				crm_err("%s: invalid value of %s in [%s]", file, key, groups[i]);
+				valid = FALSE;
+			} else if (strcmp(key, "read") == 0 || strcmp(key, "write") == 0) {
+				if (i != 0 || type != NULL) {
+					crm_err("%s: [%s] needs one read or write key", file, groups[i]);
+					valid = FALSE;
+				} else {
+					type = g_strdup(key);
+					path = g_strdup(value);
+				}
+			} else if (strcmp(key, "attr") == 0) {
+				crm_err("%s: the attribute is the name of the group, not %s in [%s]",
+					file, key, groups[i]);
+				valid = FALSE;
+			} else {
+				items = g_list_insert_sorted(items, g_strdup_printf("%s=%s", key, value),
+					(GCompareFunc)strcmp);
+			}
+			g_free(value);
+		}
+		g_strfreev(keys);
+	}
+	if (valid && type == NULL) {
+		crm_err("%s: [%s] has no read or write key", file, group);
+		valid = FALSE;
+	}
+
+	if (valid) {
+		out = g_string_new(NULL);
+		g_string_append_printf(out, "%s:%s,attr=%s", type, path, group);
+		for (gIter = items; gIter != NULL; gIter = gIter->next) {
+			g_string_append_printf(out, ",%s", (char *)gIter->data);
+		}
+		spec = g_string_free(out, FALSE);
+	}
+	g_list_free_full(items, g_free);
+	g_free(type);
+	g_free(path);
+	return spec;
+}
+
+/*
+ * Read the targets of file.  On success *specs is the list of their
+ * specifications, which the caller frees with g_free.
+ */
+int diskd_config_read(const char *file, GList **specs)
+{
+	GKeyFile *kf = g_key_file_new();
+	GError *gerr = NULL;
+	GList *list = NULL;
+	gchar **groups;
+	int i, rc = 0;
+
+	if (!g_key_file_load_from_file(kf, file, G_KEY_FILE_NONE, &gerr)) {
+		crm_err("Could not read %s: %s", file, gerr->message);
+		g_error_free(gerr);
+		g_key_file_free(kf);
+		return -1;
+	}
+	groups = g_key_file_get_groups(kf, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		char *spec;
+
+		if (strcmp(groups[i], CONFIG_DEFAULTS) == 0) {
+			continue;
+		}
+		spec = diskd_config_target(kf, file, groups[i]);
+		if (spec == NULL) {
+			rc = -1;
+			break;
+		}
+		list = g_list_append(list, spec);
+	}
+	g_strfreev(groups);
+	g_key_file_free(kf);
+
+	if (rc < 0) {
+		g_list_free_full(list, g_free);
+		return -1;
+	}
+	crm_debug("Read %d targets from %s", g_list_length(list), file);
+	*specs = list;
+	return 0;
+}
@@ -0,0 +1,130 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   CRC32C (Castagnoli) of the verified write check.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * The SSE4.2 crc32 instruction computes CRC32C 8 bytes at a time, which
+ * makes checking a page a few hundred nanoseconds.  Other CPUs use a
+ * slicing-by-8 table.  The instruction is selected at run time, so one
+ * binary runs everywhere.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define CRC32C_POLY		0x82F63B78	/* reversed Castagnoli polynomial */
+
+static guint32 crc32c_table[8][256];
+static guint32 (*crc32c_impl)(guint32 crc, const guchar *p, size_t len) = NULL;
+
+static guint32 diskd_crc32c_sw(guint32 crc, const guchar *p, size_t len)
+{
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		guint64 v;
+
+		memcpy(&v, p, 8);
+		v ^= crc;	/* little endian */
+		crc = crc32c_table[7][v & 0xff]
+			^ crc32c_table[6][(v >> 8) & 0xff]
+			^ crc32c_table[5][(v >> 16) & 0xff]
+			^ crc32c_table[4][(v >> 24) & 0xff]
+			^ crc32c_table[3][(v >> 32) & 0xff]
+			^ crc32c_table[2][(v >> 40) & 0xff]
+			^ crc32c_table[1][(v >> 48) & 0xff]
+			^ crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static guint32 diskd_crc32c_hw(guint32 crc, const guchar *p, size_t len)
+{
+	guint64 c = crc;
+
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		c = __builtin_ia32_crc32qi((guint32)c, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		guint64 v;
+
+		memcpy(&v, p, 8);
+		c = __builtin_ia32_crc32di(c, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		c = __builtin_ia32_crc32qi((guint32)c, *p++);
+		len--;
+	}
+	return (guint32)c;
+}
+#endif
+
+static void diskd_crc32c_init(void)
+{
+	guint32 i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xff]
+				^ (crc32c_table[j - 1][i] >> 8);
+		}
+	}
+	crc32c_impl = diskd_crc32c_sw;
+#if defined(__x86_64__) && defined(__GNUC__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = diskd_crc32c_hw;
+	}
+#endif
+	crm_debug("Using %s CRC32C", (crc32c_impl == diskd_crc32c_sw)? "table" : "SSE4.2");
+}
+
+guint32 diskd_crc32c(const void *buf, size_t len)
+{
+	if (crc32c_impl == NULL) {
+		diskd_crc32c_init();
+	}
+	return ~crc32c_impl(~0U, buf, len);
+}
@@ -0,0 +1,409 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Local control socket.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * A client connects to the unix socket given by -S, sends one command
+ * line and reads the text reply until the daemon closes the connection.
+ * "diskd -S <socket> -Q <command>" is such a client.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define CTL_CMD_MAX		256
+#define CTL_IO_TIMEOUT		1	/* sec. a slow client never stalls the daemon for long */
+#define CTL_IDLE_TIMEOUT	5	/* sec. for the command line of a client */
+
+typedef struct diskd_ctl_client_s {
+	int fd;
+	guint watch_id;
+	guint idle_id;
+	size_t len;
+	char cmd[CTL_CMD_MAX];
+} diskd_ctl_client_t;
+
+static int ctl_fd = -1;
+static guint ctl_watch_id = 0;
+static char *ctl_path = NULL;
+
+/* CPU time of the whole daemon, and per attempt of all targets */
+static void diskd_ctl_cpu(GString *out)
+{
+	struct rusage ru;
+	guint64 probes = 0, user, sys;
+	GList *gIter;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) {
+		return;
+	}
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		probes += ((diskd_target_t *)gIter->data)->probes;
+	}
+	user = (guint64)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+	sys = (guint64)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+	g_string_append_printf(out,
+		"process cpu_user=%llu cpu_sys=%llu probes=%llu cpu_per_probe=%llu usec\n",
+		(unsigned long long)user, (unsigned long long)sys, (unsigned long long)probes,
+		(unsigned long long)(probes ? (user + sys) / probes : 0));
+}
+
+static void diskd_ctl_hist(GString *out, const char *name, const diskd_hist_t *hist,
+	gboolean buckets)
+{
+	g_string_append_printf(out, "  %-6s ", name);
+	if (buckets) {
+		g_string_append(out, "usec:count");
+		diskd_hist_buckets(out, hist);
+	} else {
+		diskd_hist_summary(out, hist);
+		g_string_append(out, " usec");
+	}
+	g_string_append(out, "\n");
+}
+
+static void diskd_ctl_attrd(GString *out, gboolean buckets)
+{
+	g_string_append_printf(out,
+		"attrd connected=%s updates=%llu failures=%llu deferred=%llu suppressed=%llu"
+		" connects=%llu connect_failures=%llu\n",
+		diskd_attrd_connected() ? "yes" : "no",
+		(unsigned long long)attrd_stats.updates,
+		(unsigned long long)attrd_stats.failures,
+		(unsigned long long)attrd_stats.deferred,
+		(unsigned long long)attrd_stats.suppressed,
+		(unsigned long long)attrd_stats.connects,
+		(unsigned long long)attrd_stats.connect_failures);
+	diskd_ctl_hist(out, "ipc", &attrd_stats.latency, buckets);
+}
+
+static void diskd_ctl_stats(GString *out, gboolean buckets)
+{
+	GList *gIter;
+	int phase;
+
+	diskd_ctl_cpu(out);
+	diskd_ctl_attrd(out, buckets);
+	if (io_engine == diskd_io_worker) {
+		diskd_worker_summary(out);
+	}
+	diskd_rt_summary(out);
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		g_string_append_printf(out,
+			"target %s path=%s type=%s value=%s interval=%d probes=%llu errors=%llu timeouts=%llu"
+			" verify_errors=%llu error_events=%llu recoveries=%llu baseline=%lld"
+			" skipped=%llu stalls=%llu window_fail=%d/%d window_ok=%d/%d\n",
+			target->attr, target->path,
+			(target->type == diskd_probe_write)? "write" : "read",
+			target->value ? target->value : "none",
+			target->cur_interval,
+			(unsigned long long)target->probes,
+			(unsigned long long)(target->probes - target->probes_ok),
+			(unsigned long long)target->timeouts,
+			(unsigned long long)target->verify_errors,
+			(unsigned long long)target->error_events,
+			(unsigned long long)target->recoveries,
+			(long long)target->baseline,
+			(unsigned long long)target->passive_skips,
+			(unsigned long long)target->stalls,
+			diskd_vote_count(target, TRUE, target->fail_m), target->fail_m,
+			diskd_vote_count(target, FALSE, target->recover_m), target->recover_m);
+		for (phase = 0; phase < DISKD_PHASE_MAX; phase++) {
+			diskd_ctl_hist(out, diskd_phase_name(phase), &target->hist[phase], buckets);
+		}
+		/* from the first failed attempt to ERROR */
+		diskd_ctl_hist(out, "detect", &target->detect, buckets);
+		/* from the due time of a cycle to its start */
+		diskd_ctl_hist(out, "jitter", &target->jitter, buckets);
+		if (target->burst.interval > 0) {
+			g_string_append_printf(out,
+				"  burst  mbps=%lld iops=%lld bursts=%llu failures=%llu skipped=%llu running=%s\n",
+				(long long)target->mbps, (long long)target->iops,
+				(unsigned long long)target->bursts,
+				(unsigned long long)target->burst_failures,
+				(unsigned long long)target->burst_skips,
+				target->burst_run ? "yes" : "no");
+		}
+	}
+}
+
+/*
+ * The last result of each target.  A result older than limit means the
+ * checks of the target have stopped; state is "stale" then.
+ */
+static void diskd_ctl_status(GString *out)
+{
+	gint64 now = g_get_monotonic_time();
+	GList *gIter;
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+		gint64 age = (now - target->result_time) / 1000;
+		gint64 limit = (gint64)target->cur_interval + (target->retry + 1) * target->timeout
+			+ target->retry * target->retry_interval + 1000;
+
+		g_string_append_printf(out,
+			"target %s value=%s age=%lld latency=%lld limit=%lld state=%s\n",
+			target->attr, target->value ? target->value : "none",
+			(long long)age, (long long)target->last_latency, (long long)limit,
+			(age > limit)? "stale" : "fresh");
+	}
+}
+
+static void diskd_ctl_command(const char *cmd, GString *out)
+{
+	if (strcmp(cmd, "status") == 0) {
+		diskd_ctl_status(out);
+	} else if (strcmp(cmd, "stats") == 0) {
+		diskd_ctl_stats(out, FALSE);
+	} else if (strcmp(cmd, "histogram") == 0) {
+		diskd_ctl_stats(out, TRUE);
+	} else if (strcmp(cmd, "reload") == 0) {
+		if (diskd_reload(out) < 0) {
+			g_string_append(out, "error: reload failed, the targets are not changed\n");
+		}
+	} else if (strcmp(cmd, "help") == 0) {
+		g_string_append(out, "commands: status stats histogram reload help\n");
+	} else {
+		g_string_append_printf(out, "error: unknown command \"%s\"\n", cmd);
+	}
+}
+
+static void diskd_ctl_reply(diskd_ctl_client_t *client)
+{
+	GString *out = g_string_sized_new(4096);
+	size_t done = 0;
+
+	diskd_ctl_command(g_strstrip(client->cmd), out);
+
+	while (done < out->len) {
+		/* a client that gave up must not kill the daemon with SIGPIPE */
+		ssize_t rc = send(client->fd, out->str + done, out->len - done, MSG_NOSIGNAL);
+
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			crm_debug("Could not send the reply on the control socket: %s", strerror(errno));
+			break;
+		}
+		done += rc;
+	}
+	g_string_free(out, TRUE);
+}
+
+static void diskd_ctl_client_free(diskd_ctl_client_t *client)
+{
+	if (client->idle_id != 0) {
+		g_source_remove(client->idle_id);
+	}
+	close(client->fd);
+	free(client);
+}
+
+/* The client connected but has not sent its command in time. */
+static gboolean diskd_ctl_client_idle(gpointer data)
+{
+	diskd_ctl_client_t *client = data;
+
+	crm_debug("Closing an idle client of the control socket");
+	client->idle_id = 0;
+	g_source_remove(client->watch_id);
+	diskd_ctl_client_free(client);
+	return FALSE;
+}
+
+static gboolean diskd_ctl_client_dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	diskd_ctl_client_t *client = data;
+	ssize_t rc = 0;
+
+	if (condition & G_IO_IN) {
+		rc = read(client->fd, client->cmd + client->len, sizeof(client->cmd) - 1 - client->len);
+		if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return TRUE;
+		}
+	}
+	if (rc > 0) {
+		client->len += rc;
+		client->cmd[client->len] = '\0';
+		if (strchr(client->cmd, '\n') == NULL && client->len < sizeof(client->cmd) - 1) {
+			return TRUE;	/* wait for the rest of the line */
+		}
+		*strchrnul(client->cmd, '\n') = '\0';
+	}
+	if (client->len > 0) {
+		diskd_ctl_reply(client);
+	}
+	diskd_ctl_client_free(client);
+	return FALSE;
+}
+
+static gboolean diskd_ctl_dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	struct timeval tv = { CTL_IO_TIMEOUT, 0 };
+	diskd_ctl_client_t *client;
+	GIOChannel *channel;
+	int fd;
+
+	fd = accept4(ctl_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR) {
+			crm_perror(LOG_WARNING, "accept on the control socket failed");
+		}
+		return TRUE;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	client = calloc(1, sizeof(diskd_ctl_client_t));
+	client->fd = fd;
+	channel = g_io_channel_unix_new(fd);
+	client->watch_id = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+		diskd_ctl_client_dispatch, client);
+	g_io_channel_unref(channel);
+	client->idle_id = g_timeout_add_seconds(CTL_IDLE_TIMEOUT, diskd_ctl_client_idle, client);
+	return TRUE;
+}
+
+static int diskd_ctl_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		crm_err("Control socket path is too long: %s", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+int diskd_ctl_init(const char *path)
+{
+	struct sockaddr_un addr;
+	GIOChannel *channel;
+	mode_t mask;
+
+	if (path == NULL) {
+		return 0;
+	}
+	if (diskd_ctl_address(path, &addr) < 0) {
+		return -1;
+	}
+
+	ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ctl_fd < 0) {
+		crm_perror(LOG_ERR, "Could not create the control socket");
+		return -1;
+	}
+	unlink(path);
+	mask = umask(0077);
+	if (bind(ctl_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(ctl_fd, 16) < 0) {
+		umask(mask);
+		crm_perror(LOG_ERR, "Could not listen on %s", path);
+		close(ctl_fd);
+		ctl_fd = -1;
+		return -1;
+	}
+	umask(mask);
+	ctl_path = strdup(path);
+
+	channel = g_io_channel_unix_new(ctl_fd);
+	ctl_watch_id = g_io_add_watch(channel, G_IO_IN, diskd_ctl_dispatch, NULL);
+	g_io_channel_unref(channel);
+	crm_info("Listening on %s", path);
+	return 0;
+}
+
+void diskd_ctl_fini(void)
+{
+	if (ctl_fd < 0) {
+		return;
+	}
+	if (ctl_watch_id != 0) {
+		g_source_remove(ctl_watch_id);
+		ctl_watch_id = 0;
+	}
+	close(ctl_fd);
+	ctl_fd = -1;
+	unlink(ctl_path);
+	free(ctl_path);
+	ctl_path = NULL;
+}
+
+/*
+ * Client side of -Q. Prints the reply and returns 0, or 1 on failure.
+ * The daemon answers from its main loop, which a check with the sync
+ * engine blocks for up to the check timeout, so the reply is waited for
+ * timeout msec.
+ */
+int diskd_ctl_query(const char *path, const char *cmd, int timeout)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+	char buf[4096];
+	ssize_t rc;
+	int fd;
+
+	if (path == NULL || diskd_ctl_address(path, &addr) < 0) {
+		return 1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Could not connect to %s: %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	if (dprintf(fd, "%s\n", cmd) < 0) {
+		close(fd);
+		return 1;
+	}
+	shutdown(fd, SHUT_WR);
+	while ((rc = read(fd, buf, sizeof(buf))) > 0) {
+		fwrite(buf, 1, rc, stdout);
+	}
+	close(fd);
+	fflush(stdout);
+	return (rc < 0) ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Prints the probe trace file of diskd.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <diskd.h>
+
+static const char *result_names[] = {
+	"ok", "error", "timeout", "busy", "passive", "stall"
+};
+
+static const char *phase_names[DISKD_TRACE_PHASES] = {
+	"open", "io", "close", "total"
+};
+
+static void usage(const char *cmd, int exit_status)
+{
+	FILE *stream = exit_status ? stderr : stdout;
+
+	fprintf(stream, "usage: %s [-n <number>] [-a <attr-name>] <trace file>\n", cmd);
+	fprintf(stream, "    -n <number>\tPrint only the last records\n");
+	fprintf(stream, "    -a <attr-name>\tPrint only the records of a target\n");
+	fprintf(stream, "    -h\t\t\tThis text\n");
+	exit(exit_status);
+}
+
+static const char *status_name(int value)
+{
+	switch (value) {
+	case ERROR:
+		return "ERROR";
+	case normal:
+		return "normal";
+	case degraded:
+		return "degraded";
+	default:
+		return "NONE";
+	}
+}
+
+static void print_record(const diskd_trace_record_t *rec)
+{
+	char when[64];
+	time_t sec = rec->time / G_USEC_PER_SEC;
+	struct tm tm;
+	int i;
+
+	localtime_r(&sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%06lld #%llu %.*s %.*s attempt=%u result=%s", when,
+		(long long)(rec->time % G_USEC_PER_SEC), (unsigned long long)(rec->seq - 1),
+		DISKD_TRACE_ATTR_LEN, rec->attr, DISKD_TRACE_PATH_LEN, rec->path,
+		rec->attempt, rec->result < G_N_ELEMENTS(result_names)
+			? result_names[rec->result] : "unknown");
+	if (rec->error != 0) {
+		printf(" error=%s(%d)", strerror(rec->error), rec->error);
+	}
+	if (rec->latency >= 0) {
+		printf(" latency=%lld", (long long)rec->latency);
+		for (i = 0; i < DISKD_TRACE_PHASES; i++) {
+			if (rec->phase[i] >= 0 && i != diskd_phase_total) {
+				printf(" %s=%d", phase_names[i], rec->phase[i]);
+			}
+		}
+	}
+	printf(" value=%s\n", status_name(rec->value));
+}
+
+/* torn records, or ones overwritten while the file was read, do not match */
+static gboolean record_match(const diskd_trace_record_t *rec, guint64 seq, const char *attr)
+{
+	if (rec->seq != seq + 1) {
+		return FALSE;
+	}
+	return attr == NULL || strncmp(rec->attr, attr, DISKD_TRACE_ATTR_LEN) == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	diskd_trace_header_t header;
+	diskd_trace_record_t *ring;
+	guint64 first, seq, count = 0, total = 0;
+	const char *attr = NULL;
+	FILE *fp;
+	int flag;
+
+	while ((flag = getopt(argc, argv, "n:a:h")) != -1) {
+		switch (flag) {
+		case 'n':
+			count = strtoull(optarg, NULL, 10);
+			break;
+		case 'a':
+			attr = optarg;
+			break;
+		case 'h':
+			usage(argv[0], 0);
+			break;
+		default:
+			usage(argv[0], 1);
+			break;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0], 1);
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	if (fread(&header, sizeof(header), 1, fp) != 1
+	    || header.magic != DISKD_TRACE_MAGIC || header.version != DISKD_TRACE_VERSION
+	    || header.record_size != sizeof(diskd_trace_record_t) || header.records == 0) {
+		fprintf(stderr, "%s is not a trace file of this version of diskd\n", argv[optind]);
+		fclose(fp);
+		return 1;
+	}
+	ring = calloc(header.records, sizeof(diskd_trace_record_t));
+	if (ring == NULL
+	    || fseek(fp, DISKD_TRACE_HEADER_SIZE, SEEK_SET) < 0
+	    || fread(ring, sizeof(diskd_trace_record_t), header.records, fp) != header.records) {
+		fprintf(stderr, "%s is truncated\n", argv[optind]);
+		free(ring);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	/* oldest first. with -n, skip all but the last count that match */
+	first = (header.head > header.records) ? header.head - header.records : 0;
+	for (seq = first; seq < header.head; seq++) {
+		if (record_match(&ring[seq % header.records], seq, attr)) {
+			total++;
+		}
+	}
+	for (seq = first; seq < header.head; seq++) {
+		const diskd_trace_record_t *rec = &ring[seq % header.records];
+
+		if (!record_match(rec, seq, attr)) {
+			continue;
+		}
+		if (count != 0 && total-- > count) {
+			continue;
+		}
+		print_record(rec);
+	}
+	free(ring);
+	return 0;
+}
@@ -0,0 +1,145 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Probe latency histograms.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * Log-linear histogram of microsecond values, as HdrHistogram does it:
+ * values below DISKD_HIST_SUB are counted exactly, and every power of two
+ * above is split into DISKD_HIST_SUB linear buckets, so the relative
+ * error stays below 1/DISKD_HIST_SUB over the whole range.  Recording is
+ * a few shifts and an increment.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define DISKD_HIST_SUB_BITS	3
+#define DISKD_HIST_SUB		(1 << DISKD_HIST_SUB_BITS)
+
+static const char *phase_names[DISKD_PHASE_MAX] = {
+	"open", "io", "close", "total"
+};
+
+const char *diskd_phase_name(enum diskd_phase phase)
+{
+	return phase_names[phase];
+}
+
+static int diskd_hist_index(guint64 value)
+{
+	int msb;
+
+	if (value < DISKD_HIST_SUB) {
+		return (int)value;
+	}
+	msb = 63 - __builtin_clzll(value);
+	return MIN((msb - DISKD_HIST_SUB_BITS + 1) * DISKD_HIST_SUB
+		+ (int)((value >> (msb - DISKD_HIST_SUB_BITS)) & (DISKD_HIST_SUB - 1)),
+		DISKD_HIST_BUCKETS - 1);
+}
+
+/* lowest value counted in the bucket */
+guint64 diskd_hist_bucket_value(int index)
+{
+	int shift;
+
+	if (index < DISKD_HIST_SUB) {
+		return index;
+	}
+	shift = index / DISKD_HIST_SUB - 1;
+	return (guint64)(DISKD_HIST_SUB + index % DISKD_HIST_SUB) << shift;
+}
+
+void diskd_hist_record(diskd_hist_t *hist, gint64 value)
+{
+	guint64 v = (value < 0) ? 0 : (guint64)value;
+
+	if (hist->count == 0 || v < hist->min) {
+		hist->min = v;
+	}
+	if (v > hist->max) {
+		hist->max = v;
+	}
+	hist->count++;
+	hist->sum += v;
+	hist->buckets[diskd_hist_index(v)]++;
+}
+
+void diskd_hist_reset(diskd_hist_t *hist)
+{
+	memset(hist, 0, sizeof(diskd_hist_t));
+}
+
+/* pct is 0-100. The result is the upper bound of the bucket, capped by max. */
+guint64 diskd_hist_percentile(const diskd_hist_t *hist, double pct)
+{
+	guint64 rank, seen = 0;
+	int i;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+	rank = (guint64)(hist->count * pct / 100.0 + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	for (i = 0; i < DISKD_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			if (i == DISKD_HIST_BUCKETS - 1) {
+				return hist->max;
+			}
+			return MIN(diskd_hist_bucket_value(i + 1) - 1, hist->max);
+		}
+	}
+	return hist->max;
+}
+
+void diskd_hist_summary(GString *out, const diskd_hist_t *hist)
+{
+	g_string_append_printf(out,
+		"count=%llu min=%llu mean=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu",
+		(unsigned long long)hist->count,
+		(unsigned long long)hist->min,
+		(unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+		(unsigned long long)diskd_hist_percentile(hist, 50.0),
+		(unsigned long long)diskd_hist_percentile(hist, 90.0),
+		(unsigned long long)diskd_hist_percentile(hist, 99.0),
+		(unsigned long long)diskd_hist_percentile(hist, 99.9),
+		(unsigned long long)hist->max);
+}
+
+/* non-empty buckets as "<lowest value>:<count>" */
+void diskd_hist_buckets(GString *out, const diskd_hist_t *hist)
+{
+	int i;
+
+	for (i = 0; i < DISKD_HIST_BUCKETS; i++) {
+		if (hist->buckets[i] != 0) {
+			g_string_append_printf(out, " %llu:%u",
+				(unsigned long long)diskd_hist_bucket_value(i), hist->buckets[i]);
+		}
+	}
+}
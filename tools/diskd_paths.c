@@ -0,0 +1,116 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Paths of a device-mapper device.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * A read check of a dm-multipath device succeeds as long as one path
+ * works.  With paths=yes every slave of the device is also checked as a
+ * target of its own, and the device publishes how many of them work as
+ * <attr>_paths_ok=<ok>/<all>.  Only the direct slaves are used, so a
+ * logical volume on a multipath device should name the multipath device.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+/*
+ * The device names of the slaves of target->path, sorted.
+ * Returns NULL if it has none.
+ */
+GList *diskd_paths_discover(diskd_target_t *target)
+{
+	struct stat st;
+	struct dirent *de;
+	GList *paths = NULL;
+	char *dir;
+	DIR *dp;
+
+	if (stat(target->path, &st) < 0 || !S_ISBLK(st.st_mode)) {
+		crm_err("%s is not a block device", target->path);
+		return NULL;
+	}
+	dir = g_strdup_printf("/sys/dev/block/%u:%u/slaves",
+		major(st.st_rdev), minor(st.st_rdev));
+	dp = opendir(dir);
+	if (dp == NULL) {
+		crm_perror(LOG_ERR, "Could not read %s", dir);
+		g_free(dir);
+		return NULL;
+	}
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		paths = g_list_insert_sorted(paths, g_strdup_printf("/dev/%s", de->d_name),
+			(GCompareFunc)strcmp);
+	}
+	closedir(dp);
+	if (paths == NULL) {
+		crm_err("%s has no slaves in %s", target->path, dir);
+	}
+	g_free(dir);
+	return paths;
+}
+
+/*
+ * Count the working paths of a device after a path was checked.
+ * Returns TRUE if the count changed.
+ */
+gboolean diskd_paths_update(diskd_target_t *target)
+{
+	GList *gIter;
+	int ok = 0, all = 0;
+
+	if (target->paths == NULL) {
+		return FALSE;
+	}
+	for (gIter = target->paths; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *path = gIter->data;
+
+		if (path->status == NONE) {
+			return FALSE;	/* wait until every path has been checked */
+		}
+		if (path->status != ERROR) {
+			ok++;
+		}
+		all++;
+	}
+	if (ok == target->paths_ok) {
+		return FALSE;
+	}
+	if (ok < target->paths_ok) {
+		crm_warn("%d of %d paths of %s work", ok, all, target->path);
+	} else {
+		crm_info("%d of %d paths of %s work", ok, all, target->path);
+	}
+	target->paths_ok = ok;
+	g_snprintf(target->paths_value, sizeof(target->paths_value), "%d/%d", ok, all);
+	return TRUE;
+}
@@ -0,0 +1,152 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Realtime mode.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * The daemon is needed most when the node is short of memory and the sick
+ * disk may back the swap.  In realtime mode its memory is locked so that
+ * it never waits for a page fault, the probe I/O is given the realtime
+ * I/O class so that it does not queue behind bulk I/O, and optionally the
+ * daemon runs under SCHED_FIFO.  It is set up before the timer thread and
+ * the workers are started, which inherit the priorities; the lock of the
+ * memory is not inherited, so each worker locks its own.
+ *
+ * A healthy check cycle does not allocate: the buffers, the request batch
+ * and the deadline timer of each target are made once and reused.  A
+ * failed attempt still adds a timer for its retry, and a value sent to
+ * attrd goes through the IPC of pacemaker, which builds its message on
+ * the heap.  Those happen on a change, not in every cycle.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+/* <linux/ioprio.h> is not installed everywhere */
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_RT		1
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_RT_LEVEL		4	/* the middle of the realtime levels */
+
+#define RT_STACK_PREFAULT	(64 * 1024)
+
+gboolean realtime_flag = FALSE;
+int rt_priority = 0;		/* SCHED_FIFO priority, 0 to keep SCHED_OTHER */
+
+static gboolean rt_locked = FALSE;
+static gboolean rt_ioprio = FALSE;
+static gboolean rt_fifo = FALSE;
+
+/* touch the stack the check path may use, so that it is locked too */
+static void diskd_rt_prefault_stack(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+
+	memset((char *)stack, 0, sizeof(stack));
+}
+
+int diskd_rt_init(void)
+{
+	if (!realtime_flag) {
+		return 0;
+	}
+
+	/* The daemon keeps working without any of them, only less well. */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		crm_perror(LOG_WARNING, "Could not lock the memory of the daemon");
+	} else {
+		rt_locked = TRUE;
+		diskd_rt_prefault_stack();
+	}
+
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    (IOPRIO_CLASS_RT << IOPRIO_CLASS_SHIFT) | IOPRIO_RT_LEVEL) < 0) {
+		crm_perror(LOG_WARNING, "Could not set the realtime I/O priority");
+	} else {
+		rt_ioprio = TRUE;
+	}
+
+	if (rt_priority > 0) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			crm_perror(LOG_WARNING, "Could not set SCHED_FIFO priority %d", rt_priority);
+		} else {
+			rt_fifo = TRUE;
+		}
+	}
+
+	crm_info("Realtime mode: memory %s, I/O class %s, scheduler %s",
+		rt_locked ? "locked" : "not locked", rt_ioprio ? "realtime" : "unchanged",
+		rt_fifo ? "SCHED_FIFO" : "unchanged");
+	return 0;
+}
+
+/* in a forked worker, which inherits the priorities but not the lock */
+void diskd_rt_child(void)
+{
+	if (rt_locked && mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+		diskd_rt_prefault_stack();
+	}
+}
+
+/* in a forked child that must not compete with others, like a burst */
+void diskd_rt_drop(void)
+{
+	struct sched_param param;
+
+	if (rt_fifo) {
+		memset(&param, 0, sizeof(param));
+		sched_setscheduler(0, SCHED_OTHER, &param);
+	}
+	if (rt_ioprio) {
+		/* the class of the CPU priority */
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, 0);
+	}
+}
+
+void diskd_rt_summary(GString *out)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) {
+		return;
+	}
+	g_string_append_printf(out,
+		"realtime enabled=%s mlock=%s ioprio=%s sched=%s priority=%d"
+		" major_faults=%ld minor_faults=%ld\n",
+		realtime_flag ? "yes" : "no", rt_locked ? "yes" : "no",
+		rt_ioprio ? "rt" : "default", rt_fifo ? "fifo" : "other",
+		rt_fifo ? rt_priority : 0, ru.ru_majflt, ru.ru_minflt);
+}
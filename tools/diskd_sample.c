@@ -0,0 +1,189 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Offsets sampled by the read check.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * Every attempt of a read check reads target->samples blocks.  The
+ * offsets come from a small generator seeded per target, so a given seed
+ * always visits the same blocks in the same order, and a failing region
+ * found once can be found again.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+int diskd_sample_parse_mode(const char *name)
+{
+	if (strcmp(name, "head") == 0) {
+		return diskd_sample_head;
+	} else if (strcmp(name, "random") == 0) {
+		return diskd_sample_random;
+	} else if (strcmp(name, "stride") == 0) {
+		return diskd_sample_stride;
+	}
+	return -1;
+}
+
+const char *diskd_sample_mode_name(enum diskd_sample_mode mode)
+{
+	switch (mode) {
+		case diskd_sample_random:
+			return "random";
+		case diskd_sample_stride:
+			return "stride";
+		default:
+			return "head";
+	}
+}
+
+void diskd_sample_reset(diskd_target_t *target)
+{
+	/* splitmix64 of the seed, so that close seeds give unrelated sequences */
+	guint64 z = target->seed + 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	target->rng = (z != 0) ? z : 1;
+}
+
+/* xorshift64* */
+guint64 diskd_sample_next(diskd_target_t *target)
+{
+	guint64 x = target->rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	target->rng = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+int diskd_sample_size(int fd, guint64 *size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		return -1;
+	}
+	if (S_ISBLK(st.st_mode)) {
+		return ioctl(fd, BLKGETSIZE64, size);
+	}
+	*size = st.st_size;
+	return 0;
+}
+
+/*
+ * The size that O_DIRECT aligns to on fd: the logical block size of a
+ * device, which is 4096 on 4Kn disks, or the block size of a file system.
+ */
+int diskd_sample_sector(int fd)
+{
+	struct stat st;
+	int size = MIN_SECTOR_SIZE;
+
+	if (fstat(fd, &st) < 0) {
+		return -1;
+	}
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKSSZGET, &size) < 0) {
+			return -1;
+		}
+	} else if (st.st_blksize > size) {
+		size = st.st_blksize;
+	}
+	return MAX(size, MIN_SECTOR_SIZE);
+}
+
+/*
+ * Fill target->segs for one attempt on the opened device.
+ * Returns the number of segments, or -1.
+ */
+int diskd_sample_plan(diskd_target_t *target, int fd)
+{
+	guint64 size = 0, blocks, step, block = 0, first = 0;
+	size_t len;
+	int i, n, sector;
+
+	if (diskd_sample_size(fd, &size) < 0) {
+		crm_perror(LOG_ERR, "Could not get the size of %s", target->path);
+		return -1;
+	}
+	sector = diskd_sample_sector(fd);
+	if (sector < 0) {
+		crm_perror(LOG_ERR, "Could not get the block size of %s", target->path);
+		return -1;
+	}
+
+	/* offsets and lengths are multiples of the sector */
+	len = ((size_t)target->block_size + sector - 1) / sector * sector;
+	n = MIN((size_t)target->samples, target->buf_size / len);
+	if (sector != target->sector_size) {
+		if (n == 0) {
+			crm_err("%s has %d byte blocks, more than the buffer of %zu bytes",
+				target->path, sector, target->buf_size);
+		} else if (len != (size_t)target->block_size || n < target->samples) {
+			crm_warn("%s has %d byte blocks: reading %d samples of %zu bytes",
+				target->path, sector, n, len);
+		}
+		target->sector_size = sector;
+	}
+	if (n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	blocks = size / len;
+	if (blocks < (guint64)n) {
+		crm_err("%s has only %llu blocks of %zu bytes for %d samples", target->path,
+			(unsigned long long)blocks, len, n);
+		return -1;
+	}
+	step = blocks / n;
+	if (target->sample_mode == diskd_sample_stride) {
+		first = diskd_sample_next(target) % step;
+	}
+
+	for (i = 0; i < n; i++) {
+		switch (target->sample_mode) {
+			case diskd_sample_random:
+				block = diskd_sample_next(target) % blocks;
+				break;
+			case diskd_sample_stride:
+				block = first + i * step;
+				break;
+			default:
+				block = i;
+				break;
+		}
+		target->segs[i].buf = (char *)target->buf + (size_t)i * len;
+		target->segs[i].len = len;
+		target->segs[i].offset = block * len;
+	}
+	return n;
+}
@@ -0,0 +1,145 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Scheduler of the check cycles.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * All targets share one timerfd, armed with the absolute monotonic time
+ * of the earliest due cycle.  Cycles are due at fixed times from the
+ * start of each target (plus its phase), so the interval does not drift
+ * by the time a check or the main loop takes, and how late each cycle
+ * started is kept in the jitter histogram of its target.
+ */
+
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+static int sched_fd = -1;
+static guint sched_watch_id = 0;
+static gint64 sched_armed = 0;		/* due time the timerfd is set to. 0 if none */
+static diskd_sched_fn sched_fn = NULL;
+
+static void diskd_sched_arm(void)
+{
+	struct itimerspec its;
+	GList *gIter;
+	gint64 next = 0;
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (target->due != 0 && (next == 0 || target->due < next)) {
+			next = target->due;
+		}
+	}
+	if (next == sched_armed) {
+		return;
+	}
+	memset(&its, 0, sizeof(its));
+	if (next != 0) {
+		/* g_get_monotonic_time() is CLOCK_MONOTONIC */
+		its.it_value.tv_sec = next / G_TIME_SPAN_SECOND;
+		its.it_value.tv_nsec = (next % G_TIME_SPAN_SECOND) * 1000;
+	}
+	if (timerfd_settime(sched_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		crm_perror(LOG_ERR, "timerfd_settime failed");
+		return;
+	}
+	sched_armed = next;
+}
+
+static gboolean diskd_sched_dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	guint64 count;
+	GList *gIter;
+	gint64 now;
+
+	if (read(sched_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		crm_perror(LOG_ERR, "read of the timerfd failed");
+	}
+	sched_armed = 0;
+	now = g_get_monotonic_time();
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_target_t *target = gIter->data;
+
+		if (target->due == 0 || target->due > now) {
+			continue;
+		}
+		diskd_hist_record(&target->jitter, now - target->due);
+		target->last_started = target->due;
+		target->due = 0;
+		sched_fn(target);
+	}
+	diskd_sched_arm();
+	return TRUE;
+}
+
+int diskd_sched_init(diskd_sched_fn fn)
+{
+	GIOChannel *channel;
+
+	sched_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sched_fd < 0) {
+		crm_perror(LOG_ERR, "Could not create timerfd");
+		return -1;
+	}
+	sched_fn = fn;
+	channel = g_io_channel_unix_new(sched_fd);
+	sched_watch_id = g_io_add_watch(channel, G_IO_IN, diskd_sched_dispatch, NULL);
+	g_io_channel_unref(channel);
+	return 0;
+}
+
+void diskd_sched_fini(void)
+{
+	if (sched_watch_id != 0) {
+		g_source_remove(sched_watch_id);
+		sched_watch_id = 0;
+	}
+	if (sched_fd >= 0) {
+		close(sched_fd);
+		sched_fd = -1;
+	}
+	sched_armed = 0;
+}
+
+/* Run the next cycle of target at due (monotonic. usec). */
+void diskd_sched_add(diskd_target_t *target, gint64 due)
+{
+	target->due = due;
+	if (sched_fd >= 0) {
+		diskd_sched_arm();
+	}
+}
+
+void diskd_sched_remove(diskd_target_t *target)
+{
+	target->due = 0;
+	if (sched_fd >= 0) {
+		diskd_sched_arm();
+	}
+}
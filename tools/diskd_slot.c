@@ -0,0 +1,266 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Preallocated probe file of the write check.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * With the "slots" write mode the probe file is created and allocated
+ * once, and every check overwrites the next page-sized slot of it in
+ * place.  Such a write needs no inode or block allocation, so the check
+ * measures the data path of the storage instead of the journal of the
+ * file system, and it keeps working when the file system is full.
+ *
+ * With verify, each slot starts with a header holding a sequence number,
+ * the slot number and a CRC32C of the whole page, and the page is read
+ * back with O_DIRECT after the write.  Corruption, a write that went to
+ * another place and a path that returns old data are all detected.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+#define SLOT_MAGIC		0x444b5344	/* "DSKD" */
+
+/* header at the start of a verified slot */
+typedef struct diskd_slot_hdr_s {
+	guint32 magic;
+	guint32 crc;		/* CRC32C of the page with crc=0 */
+	guint64 seq;
+	gint64 time;		/* wall clock of the write. usec */
+	guint32 slot;
+	guint32 len;
+} diskd_slot_hdr_t;
+
+int diskd_slot_parse_mode(const char *name)
+{
+	if (strcmp(name, "create") == 0) {
+		return diskd_write_create;
+	} else if (strcmp(name, "slots") == 0) {
+		return diskd_write_slots;
+	}
+	return -1;
+}
+
+int diskd_slot_parse_durability(const char *name)
+{
+	if (strcmp(name, "dsync") == 0) {
+		return diskd_durability_dsync;
+	} else if (strcmp(name, "fdatasync") == 0) {
+		return diskd_durability_fdatasync;
+	} else if (strcmp(name, "rwf-dsync") == 0) {
+#ifdef RWF_DSYNC
+		return diskd_durability_rwf_dsync;
+#endif
+	}
+	return -1;
+}
+
+const char *diskd_slot_durability_name(enum diskd_durability durability)
+{
+	switch (durability) {
+		case diskd_durability_fdatasync:
+			return "fdatasync";
+		case diskd_durability_rwf_dsync:
+			return "rwf-dsync";
+		default:
+			return "dsync";
+	}
+}
+
+static int diskd_slot_open_flags(diskd_target_t *target, int flags)
+{
+	int fd;
+
+	if (target->verify) {
+		flags = (flags & ~O_WRONLY) | O_RDWR;
+	}
+	if (target->durability == diskd_durability_dsync) {
+		flags |= O_DSYNC;
+	}
+	fd = open(target->wfile, flags | O_DIRECT, 0600);
+	if (fd == -1 && errno == EINVAL) {
+		/* the file system does not support O_DIRECT */
+		fd = open(target->wfile, flags, 0600);
+	}
+	return fd;
+}
+
+/* Create the probe file and allocate all of its slots. */
+static int diskd_slot_prepare(diskd_target_t *target)
+{
+	int fd, rc;
+
+	fd = diskd_slot_open_flags(target, O_WRONLY | O_CREAT);
+	if (fd == -1) {
+		return -1;
+	}
+	rc = posix_fallocate(fd, 0, (off_t)target->slots * pagesize);
+	if (rc == 0 && fsync(fd) < 0) {
+		rc = errno;
+	}
+	if (rc != 0) {
+		close(fd);
+		errno = rc;
+		return -1;
+	}
+	if (target->verify) {
+		guchar *p = target->buf;
+		int i;
+
+		/* a payload that shows shifted data */
+		for (i = sizeof(diskd_slot_hdr_t); i < pagesize; i++) {
+			p[i] = (guchar)(i * 31 + 7);
+		}
+	}
+	crm_info("Prepared %d slots in %s", target->slots, target->wfile);
+	target->prepared = TRUE;
+	target->slot = 0;
+	return fd;
+}
+
+/* Open the probe file for a check, preparing it first if needed. */
+int diskd_slot_open(diskd_target_t *target)
+{
+	int fd;
+
+	if (!target->prepared) {
+		return diskd_slot_prepare(target);
+	}
+	fd = diskd_slot_open_flags(target, O_WRONLY);
+	if (fd == -1 && errno == ENOENT) {
+		crm_warn("%s has been removed, creating it again", target->wfile);
+		target->prepared = FALSE;
+		return diskd_slot_prepare(target);
+	}
+	return fd;
+}
+
+/*
+ * The segment for the next slot.  O_DSYNC is set at open.  The
+ * asynchronous engines cannot call fdatasync(), so they use RWF_DSYNC
+ * for it, which makes a single write just as durable.
+ */
+void diskd_slot_next(diskd_target_t *target, diskd_aio_seg_t *seg, gboolean async)
+{
+	seg->buf = target->buf;
+	seg->len = pagesize;
+	seg->offset = (off_t)target->slot * pagesize;
+	seg->rw_flags = 0;
+	if (target->verify) {
+		diskd_slot_hdr_t *hdr = target->buf;
+
+		hdr->magic = SLOT_MAGIC;
+		hdr->crc = 0;
+		hdr->seq = ++target->write_seq;
+		hdr->time = g_get_real_time();
+		hdr->slot = target->slot;
+		hdr->len = pagesize;
+		hdr->crc = diskd_crc32c(target->buf, pagesize);
+		target->vseg = *seg;
+	}
+#ifdef RWF_DSYNC
+	if (target->durability == diskd_durability_rwf_dsync
+	    || (async && target->durability == diskd_durability_fdatasync)) {
+		seg->rw_flags = RWF_DSYNC;
+	}
+#endif
+	target->slot = (target->slot + 1) % target->slots;
+}
+
+/* Write the next slot synchronously. Returns 0, or -1 with errno. */
+int diskd_slot_write(diskd_target_t *target, int fd)
+{
+	diskd_aio_seg_t seg;
+	ssize_t rc;
+
+	diskd_slot_next(target, &seg, FALSE);
+#ifdef RWF_DSYNC
+	if (seg.rw_flags != 0) {
+		struct iovec iov = { seg.buf, seg.len };
+
+		rc = pwritev2(fd, &iov, 1, seg.offset, seg.rw_flags);
+	} else
+#endif
+	{
+		rc = pwrite(fd, seg.buf, seg.len, seg.offset);
+	}
+	if (rc < 0) {
+		return -1;
+	}
+	if ((size_t)rc != seg.len) {
+		errno = EIO;
+		return -1;
+	}
+	if (target->durability == diskd_durability_fdatasync && fdatasync(fd) < 0) {
+		return -1;
+	}
+	if (target->verify) {
+		rc = pread(fd, target->vbuf, seg.len, seg.offset);
+		if (rc < 0) {
+			return -1;
+		}
+		if ((size_t)rc != seg.len || diskd_slot_verify(target) < 0) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Check the page read back into target->vbuf. Returns 0, or -1. */
+int diskd_slot_verify(diskd_target_t *target)
+{
+	diskd_slot_hdr_t *hdr = target->vbuf;
+	guint64 slot = target->vseg.offset / pagesize;
+	guint32 crc = hdr->crc;
+	const char *what = NULL;
+
+	if (hdr->magic != SLOT_MAGIC || hdr->len != (guint32)pagesize) {
+		what = "no slot header";
+	} else if (hdr->slot != slot) {
+		what = "data of another slot";
+	} else if (hdr->seq != target->write_seq) {
+		what = "old data";
+	} else {
+		hdr->crc = 0;
+		if (diskd_crc32c(hdr, pagesize) != crc) {
+			what = "corrupted data";
+		}
+		hdr->crc = crc;
+	}
+	if (what == NULL) {
+		return 0;
+	}
+	target->verify_errors++;
+	crm_err("Read back %s from slot %llu of %s (seq %llu, expected %llu)", what,
+		(unsigned long long)slot, target->wfile,
+		(unsigned long long)hdr->seq, (unsigned long long)target->write_seq);
+	return -1;
+}
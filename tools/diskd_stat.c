@@ -0,0 +1,116 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   I/O statistics of the kernel, for the passive check.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * /sys/dev/block/<maj:min>/stat counts the requests the device completed
+ * and the ones in flight.  A device that completed requests of others
+ * since the last check needs no probe, and one that has requests in
+ * flight but completes none has stalled, which is found without adding
+ * I/O of our own.  See Documentation/block/stat.rst of the kernel.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+/* fields of the stat file */
+#define STAT_READ_IOS		0
+#define STAT_WRITE_IOS		4
+#define STAT_IN_FLIGHT		8
+#define STAT_DISCARD_IOS	11	/* since 4.18 */
+#define STAT_FLUSH_IOS		15	/* since 5.5 */
+#define STAT_FIELDS		17
+
+static void diskd_stat_find(diskd_target_t *target)
+{
+	struct stat st;
+	dev_t dev;
+	char *path;
+
+	target->stat_path = strdup("");
+	if (stat(target->path, &st) < 0) {
+		return;
+	}
+	/* the device of a write target is the one of its file system */
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	path = g_strdup_printf("/sys/dev/block/%u:%u/stat", major(dev), minor(dev));
+	if (access(path, R_OK) == 0) {
+		free(target->stat_path);
+		target->stat_path = strdup(path);
+	} else {
+		crm_warn("%s has no I/O statistics, it is always probed", target->path);
+	}
+	g_free(path);
+}
+
+/*
+ * Sample the statistics of the device of target.
+ * Returns 0, or -1 if it has none.
+ */
+int diskd_stat_read(diskd_target_t *target, guint64 *done, guint64 *inflight)
+{
+	char buf[512];
+	guint64 v[STAT_FIELDS];
+	char *p, *end;
+	ssize_t len;
+	int fd, n;
+
+	if (target->stat_path == NULL) {
+		diskd_stat_find(target);
+	}
+	if (target->stat_path[0] == '\0') {
+		return -1;
+	}
+
+	fd = open(target->stat_path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return -1;
+	}
+	buf[len] = '\0';
+
+	memset(v, 0, sizeof(v));
+	for (n = 0, p = buf; n < STAT_FIELDS; n++, p = end) {
+		v[n] = g_ascii_strtoull(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+	}
+	if (n <= STAT_IN_FLIGHT) {
+		return -1;
+	}
+	*done = v[STAT_READ_IOS] + v[STAT_WRITE_IOS] + v[STAT_DISCARD_IOS] + v[STAT_FLUSH_IOS];
+	*inflight = v[STAT_IN_FLIGHT];
+	return 0;
+}
@@ -0,0 +1,172 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Probe trace in a ring file.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * Each attempt is stored as a fixed size record in a file mapped into
+ * memory, so recording it is a copy with no system call and no log line.
+ * The blocks of the file are allocated when it is opened, and the page
+ * cache writes it back on its own.  A file left by an earlier run with
+ * the same layout is continued, so that the history before a restart is
+ * kept.  diskd_dump prints it.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+G_STATIC_ASSERT(DISKD_PHASE_MAX == DISKD_TRACE_PHASES);
+G_STATIC_ASSERT(sizeof(diskd_trace_header_t) <= DISKD_TRACE_HEADER_SIZE);
+
+static diskd_trace_header_t *trace_header = NULL;
+static diskd_trace_record_t *trace_ring = NULL;
+static size_t trace_size = 0;
+
+/* a file of an earlier run that can be continued */
+static gboolean diskd_trace_valid(const diskd_trace_header_t *header, int records)
+{
+	return header->magic == DISKD_TRACE_MAGIC
+		&& header->version == DISKD_TRACE_VERSION
+		&& header->record_size == sizeof(diskd_trace_record_t)
+		&& header->records == (guint32)records;
+}
+
+int diskd_trace_open(const char *path, int records)
+{
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	trace_size = DISKD_TRACE_HEADER_SIZE + (size_t)records * sizeof(diskd_trace_record_t);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		crm_perror(LOG_ERR, "Could not open the trace file %s", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (st.st_size != 0 && (size_t)st.st_size != trace_size)) {
+		/* another size. start it over */
+		if (ftruncate(fd, 0) < 0) {
+			crm_perror(LOG_ERR, "Could not truncate the trace file %s", path);
+			close(fd);
+			return -1;
+		}
+	}
+	/* allocate the blocks now, not when a record first touches them */
+	rc = posix_fallocate(fd, 0, trace_size);
+	if (rc != 0) {
+		crm_err("Could not allocate the trace file %s: %s", path, strerror(rc));
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		crm_perror(LOG_ERR, "Could not map the trace file %s", path);
+		return -1;
+	}
+
+	trace_header = map;
+	trace_ring = (diskd_trace_record_t *)((char *)map + DISKD_TRACE_HEADER_SIZE);
+	if (diskd_trace_valid(trace_header, records)) {
+		crm_info("Continuing the trace file %s after %llu records", path,
+			(unsigned long long)trace_header->head);
+	} else {
+		memset(map, 0, trace_size);
+		trace_header->magic = DISKD_TRACE_MAGIC;
+		trace_header->version = DISKD_TRACE_VERSION;
+		trace_header->record_size = sizeof(diskd_trace_record_t);
+		trace_header->records = records;
+		trace_header->created = g_get_real_time();
+	}
+	return 0;
+}
+
+void diskd_trace_close(void)
+{
+	if (trace_header == NULL) {
+		return;
+	}
+	msync(trace_header, trace_size, MS_SYNC);
+	munmap(trace_header, trace_size);
+	trace_header = NULL;
+	trace_ring = NULL;
+}
+
+/* the end of s, if it does not fit */
+static void diskd_trace_copy(char *dst, const char *s, size_t size)
+{
+	size_t len = strlen(s);
+
+	if (len > size) {
+		s += len - size;
+		len = size;
+	}
+	memcpy(dst, s, len);
+	memset(dst + len, 0, size - len);
+}
+
+/* Record the attempt that just ended, after its status was decided. */
+void diskd_trace_record(diskd_target_t *target, enum diskd_trace_result result, int error)
+{
+	diskd_trace_record_t *rec;
+	gboolean probed = (result != diskd_trace_passive && result != diskd_trace_stall
+		&& result != diskd_trace_busy);
+	guint64 seq;
+	int i;
+
+	if (trace_header == NULL) {
+		return;
+	}
+	seq = trace_header->head;
+	rec = &trace_ring[seq % trace_header->records];
+
+	rec->seq = 0;	/* torn until the end */
+	rec->time = g_get_real_time();
+	if (!probed) {
+		rec->latency = -1;
+	} else if (target->last_phase[diskd_phase_total] >= 0) {
+		rec->latency = target->last_phase[diskd_phase_total];
+	} else {
+		/* it failed or timed out before the close */
+		rec->latency = g_get_monotonic_time() - target->probe_start;
+	}
+	for (i = 0; i < DISKD_TRACE_PHASES; i++) {
+		rec->phase[i] = probed ? (gint32)MIN(target->last_phase[i], G_MAXINT32) : -1;
+	}
+	rec->error = error;
+	rec->attempt = target->attempt;
+	rec->result = result;
+	rec->value = target->status;
+	diskd_trace_copy(rec->attr, target->attr, sizeof(rec->attr));
+	diskd_trace_copy(rec->path, target->path, sizeof(rec->path));
+	rec->seq = seq + 1;
+	trace_header->head = seq + 1;
+}
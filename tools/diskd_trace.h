@@ -0,0 +1,73 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Format of the probe trace file.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+#ifndef DISKD_TRACE__H
+#  define DISKD_TRACE__H
+
+#  include <glib.h>
+
+/*
+ * The file is a header page followed by a ring of fixed size records, one
+ * per attempt.  Record n is at slot n % records.  Both diskd and
+ * diskd_dump read it in the byte order of the host.
+ */
+#define DISKD_TRACE_MAGIC	0x5444534bU	/* "KSDT" */
+#define DISKD_TRACE_VERSION	1
+#define DISKD_TRACE_HEADER_SIZE	4096
+#define DISKD_TRACE_PHASES	4	/* open, io, close, total */
+#define DISKD_TRACE_ATTR_LEN	32
+#define DISKD_TRACE_PATH_LEN	48
+
+/* what an attempt ended with */
+enum diskd_trace_result {
+	diskd_trace_ok,
+	diskd_trace_error,	/* the I/O failed */
+	diskd_trace_timeout,	/* it missed the timeout, and was abandoned */
+	diskd_trace_busy,	/* I/O of an earlier cycle was still outstanding */
+	diskd_trace_passive,	/* decided from the I/O statistics, not probed */
+	diskd_trace_stall,	/* the statistics showed a stalled device */
+};
+
+typedef struct diskd_trace_header_s {
+	guint32 magic;
+	guint32 version;
+	guint32 record_size;
+	guint32 records;	/* slots in the ring */
+	guint64 head;		/* records written. the next goes to slot head % records */
+	gint64 created;		/* wall clock. usec */
+} diskd_trace_header_t;
+
+typedef struct diskd_trace_record_s {
+	guint64 seq;		/* record number + 1. 0 if the slot was never written */
+	gint64 time;		/* end of the attempt. wall clock. usec */
+	gint64 latency;		/* whole attempt. usec. -1 if not probed */
+	gint32 phase[DISKD_TRACE_PHASES];	/* usec. -1 if not reached */
+	gint32 error;		/* errno. 0 if it succeeded */
+	guint16 attempt;	/* retry number in the cycle. 0 for the first */
+	guint8 result;		/* enum diskd_trace_result */
+	gint8 value;		/* published status after it: ERROR, normal, degraded or NONE */
+	char attr[DISKD_TRACE_ATTR_LEN];	/* NUL padded, may not be terminated */
+	char path[DISKD_TRACE_PATH_LEN];	/* the end of the path if longer */
+} diskd_trace_record_t;
+
+#endif
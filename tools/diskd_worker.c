@@ -0,0 +1,290 @@
+/* -------------------------------------------------------------------------
+ * diskd --- monitors shared disk.
+ *   Probe worker processes.
+ *
+ * Copyright (c) 2008 NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+/*
+ * With the worker engine each target has a process forked in advance
+ * that makes the blocking checks for it.  The daemon asks it for an
+ * attempt over a socket and waits for the answer in the main loop.  A
+ * worker that misses the deadline is killed and replaced; one stuck in
+ * uninterruptible I/O cannot die until the I/O ends, so it is only
+ * counted, and no more are started while max-stuck of them remain.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+
+#include <crm/crm.h>
+#include <diskd.h>
+
+/* the worker of a target */
+typedef struct diskd_worker_s {
+	pid_t pid;
+	int fd;			/* socket to the worker */
+	guint watch_id;
+	gboolean busy;		/* an attempt is in progress */
+	gboolean abandoned;	/* killed for missing a deadline */
+	diskd_worker_done_fn done;
+} diskd_worker_t;
+
+int worker_max_stuck = 4;
+
+static diskd_worker_probe_fn worker_probe = NULL;
+static int worker_running = 0;
+static int worker_stuck = 0;		/* killed, but not exited yet */
+static guint64 worker_abandoned = 0;
+static guint64 worker_spawned = 0;
+
+/* Body of a worker: one attempt per request, until the daemon goes away. */
+static void diskd_worker_main(diskd_target_t *target, int fd)
+{
+	diskd_worker_result_t result;
+	guint64 verify_errors;
+	char req;
+	int i;
+
+	signal(SIGTERM, SIG_DFL);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	diskd_rt_child();
+	while (read(fd, &req, 1) == 1) {
+		memset(target->hist, 0, sizeof(target->hist));
+		verify_errors = target->verify_errors;
+
+		result.status = worker_probe(target);
+		for (i = 0; i < DISKD_PHASE_MAX; i++) {
+			result.phase[i] = target->hist[i].count ? (gint64)target->hist[i].sum : -1;
+		}
+		result.verify_errors = target->verify_errors - verify_errors;
+		result.error = (result.status == normal) ? 0 : target->last_error;
+		if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+			break;
+		}
+	}
+	_exit(0);
+}
+
+static void diskd_worker_exited(GPid pid, gint status, gpointer data)
+{
+	diskd_worker_t *worker = data;
+
+	if (worker->abandoned) {
+		/* its I/O has finally ended */
+		crm_info("Stuck probe worker %d has exited", (int)pid);
+		worker_stuck--;
+	}
+	worker->pid = 0;
+	if (worker->fd < 0) {
+		free(worker);
+	}
+	g_spawn_close_pid(pid);
+}
+
+static void diskd_worker_close(diskd_target_t *target)
+{
+	diskd_worker_t *worker = target->worker;
+
+	if (worker->watch_id != 0) {
+		g_source_remove(worker->watch_id);
+		worker->watch_id = 0;
+	}
+	close(worker->fd);
+	worker->fd = -1;
+	worker_running--;
+	target->worker = NULL;
+	if (worker->pid == 0) {
+		free(worker);	/* already reaped */
+	}
+}
+
+static gboolean diskd_worker_dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	diskd_target_t *target = data;
+	diskd_worker_t *worker = target->worker;
+	diskd_worker_result_t result;
+	gboolean busy = worker->busy;
+	diskd_worker_done_fn done = worker->done;
+	ssize_t rc;
+	int i;
+
+	do {
+		rc = read(worker->fd, &result, sizeof(result));
+	} while (rc < 0 && errno == EINTR);
+	if (rc == sizeof(result)) {
+		worker->busy = FALSE;
+		if (busy) {
+			done(target, &result);
+		}
+		return TRUE;
+	}
+
+	crm_err("The probe worker of %s has died", target->path);
+	worker->watch_id = 0;
+	diskd_worker_close(target);
+	diskd_worker_spawn(target);
+	if (busy) {
+		memset(&result, 0, sizeof(result));
+		result.status = ERROR;
+		for (i = 0; i < DISKD_PHASE_MAX; i++) {
+			result.phase[i] = -1;
+		}
+		done(target, &result);
+	}
+	return FALSE;
+}
+
+/* Start the worker of target. Returns -1 if it could not. */
+int diskd_worker_spawn(diskd_target_t *target)
+{
+	diskd_worker_t *worker;
+	GIOChannel *channel;
+	int fds[2];
+	pid_t pid;
+
+	if (worker_stuck >= worker_max_stuck) {
+		crm_err("%d probe workers are stuck in I/O, no more are started", worker_stuck);
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		crm_perror(LOG_ERR, "socketpair() failed");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		crm_perror(LOG_ERR, "Could not fork the probe worker of %s", target->path);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		diskd_worker_main(target, fds[1]);
+	}
+	close(fds[1]);
+
+	worker = calloc(1, sizeof(diskd_worker_t));
+	worker->pid = pid;
+	worker->fd = fds[0];
+	channel = g_io_channel_unix_new(worker->fd);
+	worker->watch_id = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+		diskd_worker_dispatch, target);
+	g_io_channel_unref(channel);
+	g_child_watch_add(pid, diskd_worker_exited, worker);
+	target->worker = worker;
+	worker_running++;
+	worker_spawned++;
+	crm_debug("Started probe worker %d for %s", (int)pid, target->path);
+	return 0;
+}
+
+int diskd_worker_init(diskd_worker_probe_fn probe)
+{
+	GList *gIter;
+
+	worker_probe = probe;
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		if (diskd_worker_spawn(gIter->data) < 0) {
+			return -1;
+		}
+	}
+	crm_info("Using %d probe workers", worker_running);
+	return 0;
+}
+
+void diskd_worker_fini(void)
+{
+	GList *gIter;
+
+	for (gIter = targets; gIter != NULL; gIter = gIter->next) {
+		diskd_worker_stop(gIter->data);
+	}
+}
+
+/* The target goes away: kill its worker. One in an attempt may be stuck. */
+void diskd_worker_stop(diskd_target_t *target)
+{
+	diskd_worker_t *worker = target->worker;
+
+	if (worker == NULL) {
+		return;
+	}
+	if (worker->pid != 0) {
+		kill(worker->pid, SIGKILL);
+		if (worker->busy) {
+			worker->abandoned = TRUE;
+			worker_stuck++;
+		}
+	}
+	diskd_worker_close(target);
+}
+
+/*
+ * Ask the worker of target for an attempt; done is called with its
+ * result.  Returns -1 if there is no worker to ask.
+ */
+int diskd_worker_submit(diskd_target_t *target, diskd_worker_done_fn done)
+{
+	diskd_worker_t *worker = target->worker;
+	char req = 0;
+
+	if (worker == NULL && diskd_worker_spawn(target) < 0) {
+		return -1;
+	}
+	worker = target->worker;
+	if (write(worker->fd, &req, 1) != 1) {
+		crm_perror(LOG_ERR, "Could not ask the probe worker of %s", target->path);
+		return -1;
+	}
+	worker->busy = TRUE;
+	worker->done = done;
+	return 0;
+}
+
+/* The attempt missed its deadline: kill the worker and start another. */
+void diskd_worker_abandon(diskd_target_t *target)
+{
+	diskd_worker_t *worker = target->worker;
+
+	if (worker == NULL) {
+		return;
+	}
+	crm_warn("Abandoning probe worker %d of %s", (int)worker->pid, target->path);
+	if (worker->pid != 0) {
+		kill(worker->pid, SIGKILL);
+		worker->abandoned = TRUE;
+		worker_stuck++;
+	}
+	worker_abandoned++;
+	diskd_worker_close(target);
+	diskd_worker_spawn(target);
+}
+
+void diskd_worker_summary(GString *out)
+{
+	g_string_append_printf(out, "workers running=%d stuck=%d max_stuck=%d spawned=%llu abandoned=%llu\n",
+		worker_running, worker_stuck, worker_max_stuck,
+		(unsigned long long)worker_spawned, (unsigned long long)worker_abandoned);
+}